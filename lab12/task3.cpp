@@ -1,23 +1,991 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <cmath>
 #include <set>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <map>
+#include <limits>
+#include <type_traits>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <malloc.h>
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
 
-const int MEMORY_LIMIT = 1000;
-const int NUM_PIVOTS = sqrt(MEMORY_LIMIT);
 const int MAX_RECURSION_DEPTH = 5;
 
-FILE* openFile(const char* name, const char* mode) {
-    FILE* f = fopen(name, mode);
-    if (!f) {
+// Промежуточные прогоны и бакеты хранятся в бинарном виде, как плотные массивы
+// записей; чтение и запись идут крупными выровненными блоками.
+const size_t IO_ALIGNMENT = 4096;
+const size_t DEFAULT_MEMORY_BUDGET = 256 << 20;
+const size_t MIN_MEMORY_BUDGET = 64 << 10;
+// Буферы от этого размера glibc берет через mmap и возвращает системе при free.
+// По умолчанию порог растет до размера последнего освобожденного буфера, и тогда
+// буферы прогонов и конвейера, освобожденные между фазами, остаются в куче и в RSS.
+const size_t MMAP_THRESHOLD = 128 << 10;
+// Память сверх бюджета, от бюджета не зависящая: код и библиотеки, стеки потоков,
+// служебные данные кучи, мелкие объекты (имена файлов, разделители). Пиковый RSS
+// сверяется с бюджетом и этим запасом в статистике.
+const size_t RSS_SLACK = 8 << 20;
+
+static_assert(sizeof(int) == sizeof(int32_t), "текстовый вход рассчитан на 32-битный int");
+
+int openFile(const char* name, int flags) {
+    int fd = open(name, flags, 0644);
+    if (fd < 0) {
         perror("Ошибка при открытии файла");
         exit(1);
     }
-    return f;
+    return fd;
+}
+
+void ioError(const char* what) {
+    perror(what);
+    exit(1);
+}
+
+// сколько файлов можно держать открытыми одновременно, с запасом под выход и stdio
+// мягкий предел поднимается до жесткого, чтобы fan-out мог доходить до тысяч бакетов
+size_t maxOpenRuns() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return 1024;
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > (1 << 16))
+        return 1 << 16;
+    return limit.rlim_cur > 16 ? limit.rlim_cur - 8 : 2;
+}
+
+// Временные файлы. Каждый запуск получает свой каталог task3-<pid>-XXXXXX в каждом
+// из каталогов сброса (--tmp-dir), поэтому параллельные сортировки в одном каталоге
+// не пересекаются. Новые файлы раскладываются по каталогам по кругу: если каталоги
+// лежат на разных дисках, ввод-вывод распределяется между ними. Каталоги запуска
+// удаляются при выходе - в том числе через exit() при ошибке и по сигналу.
+// Пока запуск жив, он держит flock на своем каталоге; каталоги, блокировку которых
+// удается взять, брошены упавшими запусками и удаляются следующим запуском. По pid
+// этого не понять: сортировка из другого pid namespace может писать в тот же каталог.
+const char SPILL_PREFIX[] = "task3-";
+// каталог моложе этого еще может быть между mkdtemp и flock
+const time_t SPILL_STALE_SECONDS = 60;
+
+void removeDirectory(const std::string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        while (struct dirent* entry = readdir(d)) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            unlink((dir + "/" + entry->d_name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+class SpillManager {
+public:
+    void open(const std::vector<std::string>& dirs) {
+        // обработчик сигнала читает jobDirs, поэтому вектор не должен перевыделяться
+        jobDirs.reserve(dirs.size());
+        for (const auto& dir : dirs) {
+            removeStale(dir);
+            std::string pattern = dir + "/" + SPILL_PREFIX + std::to_string(getpid()) + "-XXXXXX";
+            std::vector<char> name(pattern.begin(), pattern.end());
+            name.push_back('\0');
+            if (!mkdtemp(name.data())) {
+                fprintf(stderr, "Каталог для временных файлов %s: ", dir.c_str());
+                ioError("mkdtemp");
+            }
+            int fd = ::open(name.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0) {
+                rmdir(name.data());
+                fprintf(stderr, "Каталог для временных файлов %s: ", name.data());
+                ioError("flock");
+            }
+            jobDirs.push_back({name.data(), fd});
+            jobCount.store(jobDirs.size(), std::memory_order_release);
+            // каталог уже создан: с этого момента его нужно удалить при любом выходе
+            if (jobDirs.size() == 1) installCleanup();
+        }
+    }
+
+    // путь временного файла; одно и то же имя всегда попадает в один каталог
+    std::string path(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = paths.find(name);
+        if (it != paths.end()) return it->second;
+        const JobDir& dir = jobDirs[nextStripe++ % jobDirs.size()];
+        std::string full = dir.path + "/" + name;
+        paths.emplace(name, full);
+        names.store(new SpillName{dir.fd, name, names.load(std::memory_order_relaxed)}, std::memory_order_release);
+        return full;
+    }
+
+    std::vector<std::string> directories() const {
+        std::vector<std::string> result;
+        for (const auto& dir : jobDirs) result.push_back(dir.path);
+        return result;
+    }
+
+    // Вызывается и из обработчика сигнала, поэтому только async-signal-safe вызовы и
+    // ничего не выделяет: unlinkat по выданным path() именам через открытые заранее
+    // дескрипторы каталогов (работает и при исчерпанных дескрипторах), затем rmdir.
+    // Другие потоки в это время могут создавать файлы, но имя попадает в список до
+    // создания файла, поэтому проход повторяется, пока каталоги не удалятся.
+    void cleanup() {
+        if (cleaned.exchange(true)) return;
+        size_t count = jobCount.load(std::memory_order_acquire);
+        for (int pass = 0; pass < 100; ++pass) {
+            for (const SpillName* n = names.load(std::memory_order_acquire); n; n = n->next)
+                unlinkat(n->dirFd, n->name.c_str(), 0);
+            size_t removed = 0;
+            for (size_t i = 0; i < count; ++i)
+                removed += rmdir(jobDirs[i].path.c_str()) == 0 || errno == ENOENT;
+            if (removed == count) break;
+        }
+        for (size_t i = 0; i < count; ++i) close(jobDirs[i].fd);
+    }
+
+private:
+    // каталог запуска и его дескриптор, на котором держится flock
+    struct JobDir {
+        std::string path;
+        int fd;
+    };
+
+    // выданное path() имя; список только растет, обработчик сигнала читает его без блокировок
+    struct SpillName {
+        int dirFd;
+        std::string name;
+        const SpillName* next;
+    };
+
+    // брошенный каталог - тот, на котором удается взять flock
+    static void removeStale(const std::string& dir) {
+        DIR* d = opendir(dir.c_str());
+        if (!d) return;
+        time_t now = time(nullptr);
+        while (struct dirent* entry = readdir(d)) {
+            if (strncmp(entry->d_name, SPILL_PREFIX, sizeof(SPILL_PREFIX) - 1) != 0) continue;
+            std::string path = dir + "/" + entry->d_name;
+            int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0) continue;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && now - st.st_mtime >= SPILL_STALE_SECONDS && flock(fd, LOCK_EX | LOCK_NB) == 0)
+                removeDirectory(path);
+            close(fd);
+        }
+        closedir(d);
+    }
+
+    static void installCleanup();
+
+    std::mutex mutex;
+    std::vector<JobDir> jobDirs;
+    std::atomic<size_t> jobCount{0};
+    std::map<std::string, std::string> paths;
+    std::atomic<const SpillName*> names{nullptr};
+    size_t nextStripe = 0;
+    std::atomic<bool> cleaned{false};
+};
+
+SpillManager spill;
+
+void cleanupOnSignal(int sig) {
+    spill.cleanup();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void SpillManager::installCleanup() {
+    atexit([] { spill.cleanup(); });
+    for (int sig : {SIGINT, SIGTERM, SIGHUP, SIGQUIT})
+        signal(sig, cleanupOnSignal);
+}
+
+// Все размеры выводятся из бюджета памяти, заданного при запуске:
+//  - прогон занимает бюджет за вычетом буферов чтения и записи;
+//  - при распределении и слиянии половина бюджета делится между буферами бакетов/прогонов,
+//    поэтому fan-out ограничен и бюджетом, и числом открытых файлов;
+//  - в многопоточном режиме половина бюджета делится между threads + 2 буферами
+//    конвейера (по одному на рабочего, чтение и запись);
+//  - если ядро сортировки может выбрать radix, половина памяти под прогон
+//    отводится под его вспомогательный буфер.
+enum class SortKernel { Auto, Radix, Intro, Quick };
+
+SortKernel sortKernel = SortKernel::Auto;
+const size_t RADIX_SORT_THRESHOLD = 1 << 11;
+
+struct SortConfig {
+    size_t memoryBytes;
+    size_t ioBlockSize;
+    size_t runBytes;
+    size_t maxFanOut;
+    size_t threads;
+    size_t workBytes;
+    size_t runBuffers; // буферов размером с прогон: сам прогон и, если нужен, буфер radix
+};
+
+SortConfig makeSortConfig(size_t memoryBytes, size_t threads = 1) {
+    SortConfig config;
+    config.memoryBytes = std::max(memoryBytes, MIN_MEMORY_BUDGET);
+    config.threads = std::max<size_t>(threads, 1);
+    config.ioBlockSize = std::min<size_t>(8 << 20, std::max(IO_ALIGNMENT, config.memoryBytes / 16));
+    config.ioBlockSize -= config.ioBlockSize % IO_ALIGNMENT;
+    config.runBytes = config.memoryBytes - 2 * config.ioBlockSize;
+    size_t bucketBuffer = std::min<size_t>(64 << 10, config.ioBlockSize);
+    config.maxFanOut = std::max<size_t>(2, std::min(config.memoryBytes / 2 / bucketBuffer, maxOpenRuns()));
+    config.workBytes = config.threads == 1
+        ? config.runBytes
+        : config.memoryBytes / 2 / (config.threads + 2);
+    config.runBuffers = 1;
+    if (sortKernel == SortKernel::Auto || sortKernel == SortKernel::Radix) {
+        config.runBytes /= 2;
+        config.workBytes /= 2;
+        config.runBuffers = 2;
+    }
+    return config;
+}
+
+SortConfig sortConfig = makeSortConfig(DEFAULT_MEMORY_BUDGET);
+
+// сколько записей помещается в прогон и в буфер конвейера
+template <typename Record>
+size_t runCapacity() {
+    return std::max<size_t>(1, sortConfig.runBytes / sizeof(Record));
+}
+
+template <typename Record>
+size_t workCapacity() {
+    return std::max<size_t>(1, sortConfig.workBytes / sizeof(Record));
+}
+
+// прогон на пределе рекурсии: кроме выхода и читаемого бакета открыт файл прогона,
+// его блок вычитается из памяти прогона
+template <typename Record>
+size_t nestedRunCapacity() {
+    return std::max<size_t>(1, (sortConfig.runBytes - sortConfig.ioBlockSize / sortConfig.runBuffers) /
+                                   sizeof(Record));
+}
+
+// "2G", "512M", "64K" или число байт; 0 при ошибке
+size_t parseSize(const char* text) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': value <<= 10; ++end; break;
+        case 'M': case 'm': value <<= 20; ++end; break;
+        case 'G': case 'g': value <<= 30; ++end; break;
+        case 'T': case 't': value <<= 40; ++end; break;
+        default: break;
+    }
+    if (*end == 'B' || *end == 'b') ++end;
+    return *end == '\0' ? value : 0;
+}
+
+// счетчики объема ввода-вывода, по ним считается пропускная способность фаз
+std::atomic<uint64_t> bytesReadTotal(0);
+std::atomic<uint64_t> bytesWrittenTotal(0);
+// суммарное время, проведенное потоками в ожидании завершения ввода-вывода
+std::atomic<uint64_t> ioWaitNanos(0);
+
+double processCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct PhaseStats {
+    std::string name;
+    double seconds;
+    double cpuSeconds;
+    double ioWaitSeconds;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+};
+
+std::vector<PhaseStats> phaseStats;
+
+// замеряет время, процессорное время, ожидание ввода-вывода и его объем от создания до разрушения
+class PhaseTimer {
+public:
+    explicit PhaseTimer(std::string name)
+        : name(std::move(name)), start(std::chrono::steady_clock::now()), cpuStart(processCpuSeconds()),
+          waitBefore(ioWaitNanos), readBefore(bytesReadTotal), writtenBefore(bytesWrittenTotal) {}
+
+    ~PhaseTimer() {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        phaseStats.push_back({name, elapsed.count(), processCpuSeconds() - cpuStart,
+                              (ioWaitNanos - waitBefore) / 1e9,
+                              bytesReadTotal - readBefore, bytesWrittenTotal - writtenBefore});
+    }
+
+private:
+    std::string name;
+    std::chrono::steady_clock::time_point start;
+    double cpuStart;
+    uint64_t waitBefore;
+    uint64_t readBefore;
+    uint64_t writtenBefore;
+};
+
+const char* ioBackendName();
+size_t ioDepth = 2;
+
+// cpu - процессорное время всех потоков, io wait - время, проведенное в ожидании
+// дисковых операций. io wait близко ко времени фазы - упираемся в диск,
+// cpu близко ко времени (умноженному на число потоков) - в процессор.
+void printPhaseStats() {
+    fprintf(stderr, "%-22s %10s %10s %10s %10s %10s %10s\n",
+            "phase", "time, s", "cpu, s", "io wait, s", "read, MB", "write, MB", "MB/s");
+    for (const auto& p : phaseStats) {
+        double readMb = p.bytesRead / 1e6;
+        double writtenMb = p.bytesWritten / 1e6;
+        double throughput = p.seconds > 0 ? (readMb + writtenMb) / p.seconds : 0;
+        fprintf(stderr, "%-22s %10.3f %10.3f %10.3f %10.2f %10.2f %10.1f\n",
+                p.name.c_str(), p.seconds, p.cpuSeconds, p.ioWaitSeconds, readMb, writtenMb, throughput);
+    }
+    fprintf(stderr, "%-22s %32s %10.2f %10.2f\n", "total I/O", "",
+            bytesReadTotal.load() / 1e6, bytesWrittenTotal.load() / 1e6);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "memory budget %.1f MB, run %.1f MB, max fan-out %zu, I/O block %zu KB\n",
+            sortConfig.memoryBytes / 1e6, sortConfig.runBytes / 1e6, sortConfig.maxFanOut,
+            sortConfig.ioBlockSize >> 10);
+    if (sortConfig.threads > 1)
+        fprintf(stderr, "threads %zu, pipeline buffer %.1f MB\n",
+                sortConfig.threads, sortConfig.workBytes / 1e6);
+    fprintf(stderr, "I/O backend %s, depth %zu\n", ioBackendName(), ioDepth);
+    for (const auto& dir : spill.directories())
+        fprintf(stderr, "spill %s\n", dir.c_str());
+    // ru_maxrss - в килобайтах
+    const size_t peak = static_cast<size_t>(usage.ru_maxrss) << 10;
+    fprintf(stderr, "peak RSS %.1f MB, budget %.1f MB + slack %.1f MB%s\n", peak / 1e6,
+            sortConfig.memoryBytes / 1e6, RSS_SLACK / 1e6,
+            peak > sortConfig.memoryBytes + RSS_SLACK ? ": EXCEEDED" : "");
+}
+
+// целые записи переставляются в little-endian, составные пишутся как есть
+template <typename T>
+inline T toLittleEndian(T v) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if constexpr (std::is_integral<T>::value && sizeof(T) == 4)
+        return static_cast<T>(__builtin_bswap32(static_cast<uint32_t>(v)));
+    if constexpr (std::is_integral<T>::value && sizeof(T) == 8)
+        return static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(v)));
+#endif
+    return v;
+}
+
+// Буфер блока - отдельное отображение: при освобождении страницы сразу уходят системе,
+// а не остаются в куче за мелкими объектами, выделенными позже (буферы бакетов и
+// входов слияния бывают меньше порога mmap у malloc).
+struct AlignedBuffer {
+    char* data;
+    size_t size;
+
+    explicit AlignedBuffer(size_t bytes)
+        : size((bytes + IO_ALIGNMENT - 1) / IO_ALIGNMENT * IO_ALIGNMENT) {
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) ioError("Ошибка выделения буфера");
+        data = static_cast<char*>(mapped);
+    }
+
+    ~AlignedBuffer() {
+        munmap(data, size);
+    }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+};
+
+// Асинхронный ввод-вывод. Запрос отправляется submit() и дожидается ioWait();
+// между ними поток продолжает работать с другим буфером. Исполнители:
+//  - sync: операция выполняется прямо в ioWait(), без перекрытия (--io=sync);
+//  - threads: очередь запросов и пул потоков, выполняющих pread/pwrite;
+//  - uring: io_uring, одно общее кольцо (сборка с -DUSE_IO_URING -luring). Если ядро
+//    не дает создать кольцо, используется threads.
+// Запрос может дожидаться не тот поток, что его отправил: BlockInput начинает чтение
+// в конструкторе, а читает блоки поток конвейера.
+enum class IoBackend { Sync, Threads, Uring };
+
+#ifdef USE_IO_URING
+IoBackend ioBackend = IoBackend::Uring;
+#else
+IoBackend ioBackend = IoBackend::Threads;
+#endif
+
+const char* ioBackendName() {
+    switch (ioBackend) {
+        case IoBackend::Sync: return "sync";
+        case IoBackend::Threads: return "threads";
+        default: return "io_uring";
+    }
+}
+
+struct IoRequest {
+    int fd;
+    bool write;
+    char* data;
+    size_t len;
+    off_t offset;
+    ssize_t result;
+    bool done;
+    IoBackend backend;
+};
+
+// дочитывает/дописывает запрос до конца; возвращает число байт или -1
+ssize_t performIo(IoRequest& req, size_t from = 0) {
+    size_t total = from;
+    while (total < req.len) {
+        ssize_t n = req.write
+            ? pwrite(req.fd, req.data + total, req.len - total, req.offset + total)
+            : pread(req.fd, req.data + total, req.len - total, req.offset + total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        total += n;
+    }
+    return total;
+}
+
+class ThreadIoBackend {
+public:
+    static ThreadIoBackend& instance() {
+        static ThreadIoBackend backend;
+        return backend;
+    }
+
+    void submit(IoRequest* req) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(req);
+        requested.notify_one();
+    }
+
+    void wait(IoRequest* req) {
+        std::unique_lock<std::mutex> lock(mutex);
+        completed.wait(lock, [&] { return req->done; });
+    }
+
+private:
+    static const size_t IO_THREADS = 2;
+
+    ThreadIoBackend() {
+        for (size_t i = 0; i < IO_THREADS; ++i)
+            workers.emplace_back([this] { run(); });
+    }
+
+    ~ThreadIoBackend() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        requested.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    void run() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            requested.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            IoRequest* req = queue.front();
+            queue.pop_front();
+            lock.unlock();
+
+            ssize_t result = performIo(*req);
+
+            lock.lock();
+            req->result = result;
+            req->done = true;
+            completed.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable requested;
+    std::condition_variable completed;
+    std::deque<IoRequest*> queue;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+};
+
+#ifdef USE_IO_URING
+class UringIoBackend {
+public:
+    // общее кольцо или nullptr, если io_uring недоступен
+    static UringIoBackend* instance() {
+        static UringIoBackend backend;
+        return backend.ready ? &backend : nullptr;
+    }
+
+    void submit(IoRequest* req) {
+        std::lock_guard<std::mutex> lock(submitMutex);
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        while (!sqe) {
+            // очередь отправки заполнена: отдаем ее ядру и берем место заново
+            io_uring_submit(&ring);
+            sqe = io_uring_get_sqe(&ring);
+        }
+        if (req->write)
+            io_uring_prep_write(sqe, req->fd, req->data, req->len, req->offset);
+        else
+            io_uring_prep_read(sqe, req->fd, req->data, req->len, req->offset);
+        io_uring_sqe_set_data(sqe, req);
+        io_uring_submit(&ring);
+    }
+
+    // Завершения забирает один поток за раз, кто бы ни отправлял запросы; остальные
+    // ждут, пока он разберет очередное, и проверяют свой запрос. done меняется только
+    // под reapMutex.
+    void wait(IoRequest* req) {
+        std::unique_lock<std::mutex> lock(reapMutex);
+        while (!req->done) {
+            if (reaping) {
+                reaped.wait(lock);
+                continue;
+            }
+            reaping = true;
+            lock.unlock();
+            IoRequest* completed = reapOne();
+            lock.lock();
+            completed->done = true;
+            reaping = false;
+            reaped.notify_all();
+        }
+    }
+
+private:
+    UringIoBackend() {
+        ready = io_uring_queue_init(256, &ring, 0) == 0;
+    }
+
+    ~UringIoBackend() {
+        if (ready) io_uring_queue_exit(&ring);
+    }
+
+    // очередь завершений читает только поток с reaping; отправка идет параллельно
+    IoRequest* reapOne() {
+        io_uring_cqe* cqe = nullptr;
+        if (io_uring_wait_cqe(&ring, &cqe) < 0) ioError("Ошибка io_uring");
+        IoRequest* req = static_cast<IoRequest*>(io_uring_cqe_get_data(cqe));
+        req->result = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        // короткая операция дочитывается/дописывается синхронно
+        if (req->result >= 0 && static_cast<size_t>(req->result) < req->len)
+            req->result = performIo(*req, req->result);
+        return req;
+    }
+
+    io_uring ring;
+    bool ready;
+    std::mutex submitMutex;
+    std::mutex reapMutex;
+    std::condition_variable reaped;
+    bool reaping = false;
+};
+#endif
+
+void ioSubmit(IoRequest* req) {
+    req->done = false;
+    req->backend = ioBackend;
+#ifdef USE_IO_URING
+    if (req->backend == IoBackend::Uring) {
+        if (UringIoBackend* ring = UringIoBackend::instance()) {
+            ring->submit(req);
+            return;
+        }
+        req->backend = IoBackend::Threads;
+    }
+#endif
+    if (req->backend == IoBackend::Threads)
+        ThreadIoBackend::instance().submit(req);
 }
 
+void ioWait(IoRequest* req) {
+    auto start = std::chrono::steady_clock::now();
+    switch (req->backend) {
+        case IoBackend::Sync:
+            req->result = performIo(*req);
+            req->done = true;
+            break;
+        case IoBackend::Threads:
+            ThreadIoBackend::instance().wait(req);
+            break;
+        case IoBackend::Uring:
+#ifdef USE_IO_URING
+            UringIoBackend::instance()->wait(req);
+#endif
+            break;
+    }
+    ioWaitNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Чтение файла блоками с опережением: из ioDepth буферов один отдается
+// разбору, остальные в это время дочитываются.
+class BlockInput {
+public:
+    BlockInput(const char* name, size_t bufferBytes)
+        : fd(openFile(name, O_RDONLY)), requests(ioDepth), inFlight(ioDepth, false),
+          offset(0), current(ioDepth - 1), handedOut(false), eof(false) {
+        size_t each = std::max(IO_ALIGNMENT, bufferBytes / ioDepth);
+        for (size_t i = 0; i < ioDepth; ++i) {
+            buffers.emplace_back(new AlignedBuffer(each));
+            issue(i);
+        }
+    }
+
+    ~BlockInput() {
+        release();
+        close(fd);
+    }
+
+    // следующий блок файла; данные действительны до следующего вызова
+    bool nextBlock(const char*& data, size_t& len) {
+        if (eof) return false;
+        // отданный в прошлый раз буфер разобран, ставим его в очередь за следующим блоком
+        if (handedOut) issue(current);
+        current = (current + 1) % ioDepth;
+        IoRequest& req = requests[current];
+        ioWait(&req);
+        inFlight[current] = false;
+        handedOut = true;
+        if (req.result < 0) ioError("Ошибка чтения");
+        data = req.data;
+        len = req.result;
+        bytesReadTotal += len;
+        eof = len == 0;
+        // вход сортировки живет до конца, а его буферы после последнего блока не нужны
+        if (eof) release();
+        return !eof;
+    }
+
+    BlockInput(const BlockInput&) = delete;
+    BlockInput& operator=(const BlockInput&) = delete;
+
+private:
+    void release() {
+        // недочитанное опережение дожидаемся, чтобы не освободить буфер под активной операцией
+        for (size_t i = 0; i < ioDepth; ++i) {
+            if (inFlight[i] && requests[i].backend != IoBackend::Sync) ioWait(&requests[i]);
+            inFlight[i] = false;
+        }
+        buffers.clear();
+    }
+
+    void issue(size_t i) {
+        AlignedBuffer& buffer = *buffers[i];
+        requests[i] = {fd, false, buffer.data, buffer.size, offset, 0, false, IoBackend::Sync};
+        offset += buffer.size;
+        inFlight[i] = true;
+        ioSubmit(&requests[i]);
+    }
+
+    int fd;
+    std::vector<std::unique_ptr<AlignedBuffer>> buffers;
+    std::vector<IoRequest> requests;
+    std::vector<bool> inFlight;
+    off_t offset;
+    size_t current;
+    bool handedOut;
+    bool eof;
+};
+
+// Запись файла блоками: заполненный буфер уходит на запись, а заполнение
+// продолжается в следующем из ioDepth буферов.
+class BlockOutput {
+public:
+    BlockOutput(const char* name, size_t bufferBytes)
+        : fd(openFile(name, O_WRONLY | O_CREAT | O_TRUNC)), requests(ioDepth), inFlight(ioDepth, false),
+          offset(0), current(0) {
+        size_t each = std::max(IO_ALIGNMENT, bufferBytes / ioDepth);
+        for (size_t i = 0; i < ioDepth; ++i)
+            buffers.emplace_back(new AlignedBuffer(each));
+    }
+
+    ~BlockOutput() {
+        close();
+    }
+
+    char* data() {
+        return buffers[current]->data;
+    }
+
+    size_t capacity() const {
+        return buffers[current]->size;
+    }
+
+    void submit(size_t used) {
+        if (used == 0) return;
+        requests[current] = {fd, true, data(), used, offset, 0, false, IoBackend::Sync};
+        offset += used;
+        bytesWrittenTotal += used;
+        inFlight[current] = true;
+        ioSubmit(&requests[current]);
+        current = (current + 1) % ioDepth;
+        complete(current);
+    }
+
+    void close() {
+        if (fd < 0) return;
+        for (size_t i = 0; i < ioDepth; ++i) complete(i);
+        ::close(fd);
+        fd = -1;
+    }
+
+    BlockOutput(const BlockOutput&) = delete;
+    BlockOutput& operator=(const BlockOutput&) = delete;
+
+private:
+    void complete(size_t i) {
+        if (!inFlight[i]) return;
+        ioWait(&requests[i]);
+        inFlight[i] = false;
+        if (requests[i].result != static_cast<ssize_t>(requests[i].len)) ioError("Ошибка записи");
+    }
+
+    int fd;
+    std::vector<std::unique_ptr<AlignedBuffer>> buffers;
+    std::vector<IoRequest> requests;
+    std::vector<bool> inFlight;
+    off_t offset;
+    size_t current;
+};
+
+// Промежуточные файлы - плотные массивы записей фиксированного размера, записи
+// переносятся побайтно, без разбора. Целые записи хранятся в little-endian,
+// составные - в порядке байт машины: файлы живут только во время сортировки.
+template <typename Record>
+class RecordWriter {
+    static_assert(std::is_trivially_copyable<Record>::value, "записи копируются побайтно");
+    static_assert(IO_ALIGNMENT % sizeof(Record) == 0, "запись не должна пересекать границу блока");
+
+public:
+    explicit RecordWriter(const char* name, size_t bufferBytes = sortConfig.ioBlockSize)
+        : out(name, bufferBytes), buffer(out.data()), used(0) {}
+
+    ~RecordWriter() {
+        close();
+    }
+
+    void put(const Record& x) {
+        if (used + sizeof(Record) > out.capacity()) flush();
+        Record v = toLittleEndian(x);
+        memcpy(buffer + used, &v, sizeof(Record));
+        used += sizeof(Record);
+    }
+
+    void write(const Record* src, size_t count) {
+        while (count > 0) {
+            if (used == out.capacity()) flush();
+            size_t n = std::min(count, (out.capacity() - used) / sizeof(Record));
+            Record* dst = reinterpret_cast<Record*>(buffer + used);
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = toLittleEndian(src[i]);
+            used += n * sizeof(Record);
+            src += n;
+            count -= n;
+        }
+    }
+
+    void close() {
+        flush();
+        out.close();
+    }
+
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
+
+private:
+    void flush() {
+        out.submit(used);
+        buffer = out.data();
+        used = 0;
+    }
+
+    BlockOutput out;
+    char* buffer;
+    size_t used;
+};
+
+template <typename Record>
+class RecordReader {
+    static_assert(std::is_trivially_copyable<Record>::value, "записи копируются побайтно");
+    static_assert(IO_ALIGNMENT % sizeof(Record) == 0, "запись не должна пересекать границу блока");
+
+public:
+    explicit RecordReader(const char* name, size_t bufferBytes = sortConfig.ioBlockSize)
+        : in(name, bufferBytes), buffer(nullptr), pos(0), len(0) {}
+
+    bool next(Record& x) {
+        if (pos == len && !refill()) return false;
+        memcpy(&x, buffer + pos, sizeof(Record));
+        x = toLittleEndian(x);
+        pos += sizeof(Record);
+        return true;
+    }
+
+    size_t read(Record* dst, size_t count) {
+        size_t done = 0;
+        while (done < count) {
+            if (pos == len && !refill()) break;
+            size_t n = std::min(count - done, (len - pos) / sizeof(Record));
+            const Record* src = reinterpret_cast<const Record*>(buffer + pos);
+            for (size_t i = 0; i < n; ++i)
+                dst[done + i] = toLittleEndian(src[i]);
+            pos += n * sizeof(Record);
+            done += n;
+        }
+        return done;
+    }
+
+    // число записей в файле без его чтения
+    static size_t count(const char* name) {
+        struct stat st;
+        if (stat(name, &st) != 0) ioError("Ошибка при открытии файла");
+        return st.st_size / sizeof(Record);
+    }
+
+    RecordReader(const RecordReader&) = delete;
+    RecordReader& operator=(const RecordReader&) = delete;
+
+private:
+    bool refill() {
+        pos = 0;
+        if (!in.nextBlock(buffer, len)) len = 0;
+        len -= len % sizeof(Record);
+        return len > 0;
+    }
+
+    BlockInput in;
+    const char* buffer;
+    size_t pos;
+    size_t len;
+};
+
+// разбор текстового входа, выполняется один раз при загрузке
+class TextReader {
+public:
+    explicit TextReader(const char* name, size_t bufferBytes = sortConfig.ioBlockSize)
+        : in(name, bufferBytes), buffer(nullptr), pos(0), len(0), ended(false) {}
+
+    // Как fscanf("%d"): пробелы, знак, цифры. Первое, что не число (знак без цифр,
+    // точка в "1.5", буква), заканчивает ввод, как и раньше; значения из него не собираются.
+    bool next(int& x) {
+        if (ended) return false;
+        int c = get();
+        while (c == ' ' || (c >= '\t' && c <= '\r')) c = get();
+        bool negative = c == '-';
+        if (c == '-' || c == '+') c = get();
+        if (c < '0' || c > '9') {
+            ended = true;
+            return false;
+        }
+        uint32_t v = 0;
+        while (c >= '0' && c <= '9') {
+            v = v * 10 + (c - '0');
+            c = get();
+        }
+        // символ после числа - начало следующего разбора, как у fscanf
+        if (c != EOF) --pos;
+        x = static_cast<int>(negative ? 0u - v : v);
+        return true;
+    }
+
+    TextReader(const TextReader&) = delete;
+    TextReader& operator=(const TextReader&) = delete;
+
+private:
+    int get() {
+        if (pos == len) {
+            pos = 0;
+            if (!in.nextBlock(buffer, len)) {
+                len = 0;
+                return EOF;
+            }
+        }
+        return static_cast<unsigned char>(buffer[pos++]);
+    }
+
+    BlockInput in;
+    const char* buffer;
+    size_t pos;
+    size_t len;
+    bool ended;
+};
+
+// форматирование результата, выполняется один раз при выводе
+class TextWriter {
+public:
+    explicit TextWriter(const char* name, size_t bufferBytes = sortConfig.ioBlockSize)
+        : out(name, bufferBytes), buffer(out.data()), used(0) {}
+
+    ~TextWriter() {
+        close();
+    }
+
+    void put(int x) {
+        if (used + 12 > out.capacity()) flush();
+        char digits[10];
+        int n = 0;
+        uint32_t v = x < 0 ? 0u - static_cast<uint32_t>(x) : static_cast<uint32_t>(x);
+        do {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v > 0);
+        if (x < 0) buffer[used++] = '-';
+        while (n > 0) buffer[used++] = digits[--n];
+        buffer[used++] = ' ';
+    }
+
+    void close() {
+        flush();
+        out.close();
+    }
+
+    TextWriter(const TextWriter&) = delete;
+    TextWriter& operator=(const TextWriter&) = delete;
+
+private:
+    void flush() {
+        out.submit(used);
+        buffer = out.data();
+        used = 0;
+    }
+
+    BlockOutput out;
+    char* buffer;
+    size_t used;
+};
+
 void quickSort(std::vector<int>& vec, int left, int right) {
     if (left >= right) return;
     int pivot = vec[left + (right - left)/2];
@@ -35,147 +1003,1509 @@ void quickSort(std::vector<int>& vec, int left, int right) {
     quickSort(vec, i, right);
 }
 
-int readChunk(FILE* in, std::vector<int>& buffer, size_t size) {
+// Записи и правила их сравнения. SortSpec связывает тип записи, извлечение ключа
+// и компаратор ключей; весь сортировщик параметризован этой тройкой.
+template <typename Record>
+struct Identity {
+    Record operator()(const Record& r) const { return r; }
+};
+
+template <typename Record, typename KeyOf = Identity<Record>, typename Less = std::less<>>
+struct SortSpec {
+    using RecordType = Record;
+    using Key = typename std::decay<decltype(KeyOf()(std::declval<const Record&>()))>::type;
+
+    // radix и нормализованный ключ применимы только к целым ключам с обычным порядком
+    static constexpr bool integralKey =
+        std::is_integral<Key>::value && std::is_same<Less, std::less<>>::value;
+
+    static Key key(const Record& r) { return KeyOf()(r); }
+    static bool less(const Key& a, const Key& b) { return Less()(a, b); }
+    static bool recordLess(const Record& a, const Record& b) { return less(key(a), key(b)); }
+};
+
+// пара (ключ, полезная нагрузка), 16 байт
+struct KeyValue16 {
+    uint64_t key;
+    uint64_t payload;
+};
+
+// 64-битная метка времени с номером строки
+struct TimestampRow {
+    int64_t timestamp;
+    uint64_t rowId;
+};
+
+// широкая запись: на ней выгоден режим ключ-префикса
+struct Row64 {
+    uint64_t key;
+    char payload[56];
+};
+
+// ссылка для режима ключ-префикса: нормализованный ключ и номер записи во входе
+struct KeyRef {
+    uint64_t key;
+    uint64_t index;
+};
+
+struct KeyField {
+    template <typename Record>
+    uint64_t operator()(const Record& r) const { return r.key; }
+};
+
+struct TimestampField {
+    int64_t operator()(const TimestampRow& r) const { return r.timestamp; }
+};
+
+using IntSpec = SortSpec<int>;
+using Int64Spec = SortSpec<int64_t>;
+using KeyValueSpec = SortSpec<KeyValue16, KeyField>;
+using TimestampSpec = SortSpec<TimestampRow, TimestampField>;
+using Row64Spec = SortSpec<Row64, KeyField>;
+using KeyRefSpec = SortSpec<KeyRef, KeyField>;
+
+// Сортировка прогона в памяти. Ядро выбирается для каждого прогона:
+//  - уже упорядоченный или обратно упорядоченный прогон распознается за один проход;
+//  - radix: LSD по 8-битным цифрам ключа x - min, число проходов определяется
+//    шириной диапазона ключей, проходы с единственной цифрой пропускаются;
+//  - intro: introsort в духе pdqsort (медиана из трех/девяти, отдельная обработка
+//    повторов, перемешивание и heapsort при плохих разбиениях, ранний выход на
+//    почти упорядоченных кусках) - худший случай O(n log n), рекурсия O(log n);
+//  - quick: прежний quickSort, оставлен для сравнения.
+const size_t INSERTION_SORT_THRESHOLD = 24;
+const size_t NINTHER_THRESHOLD = 128;
+const size_t PARTIAL_INSERTION_LIMIT = 8;
+
+template <typename T, typename Less>
+void insertionSort(T* first, T* last, Less less) {
+    if (first == last) return;
+    for (T* cur = first + 1; cur != last; ++cur) {
+        T tmp = *cur;
+        T* sift = cur;
+        while (sift != first && less(tmp, *(sift - 1))) {
+            *sift = *(sift - 1);
+            --sift;
+        }
+        *sift = tmp;
+    }
+}
+
+// сортировка вставками, которая сдается после PARTIAL_INSERTION_LIMIT перемещений
+template <typename T, typename Less>
+bool partialInsertionSort(T* first, T* last, Less less) {
+    if (first == last) return true;
+    size_t moved = 0;
+    for (T* cur = first + 1; cur != last; ++cur) {
+        T tmp = *cur;
+        T* sift = cur;
+        while (sift != first && less(tmp, *(sift - 1))) {
+            *sift = *(sift - 1);
+            --sift;
+        }
+        *sift = tmp;
+        moved += cur - sift;
+        if (moved > PARTIAL_INSERTION_LIMIT) return false;
+    }
+    return true;
+}
+
+template <typename T, typename Less>
+void sort3(T* a, T* b, T* c, Less less) {
+    if (less(*b, *a)) std::swap(*a, *b);
+    if (less(*c, *b)) std::swap(*b, *c);
+    if (less(*b, *a)) std::swap(*a, *b);
+}
+
+// Опорный элемент в *first; равные ему уходят вправо. Возвращает позицию опорного
+// и признак того, что диапазон уже был разбит (не понадобилось ни одного обмена).
+template <typename T, typename Less>
+std::pair<T*, bool> partitionRight(T* first, T* last, Less less) {
+    T pivot = *first;
+    T* left = first;
+    T* right = last;
+    while (less(*++left, pivot)) {}
+    if (left - 1 == first) {
+        while (left < right && !less(*--right, pivot)) {}
+    } else {
+        while (!less(*--right, pivot)) {}
+    }
+    bool alreadyPartitioned = left >= right;
+    while (left < right) {
+        std::swap(*left, *right);
+        while (less(*++left, pivot)) {}
+        while (!less(*--right, pivot)) {}
+    }
+    T* pivotPos = left - 1;
+    *first = *pivotPos;
+    *pivotPos = pivot;
+    return {pivotPos, alreadyPartitioned};
+}
+
+// Равные опорному уходят влево. Используется, когда опорный равен элементу
+// перед диапазоном: тогда все равные уже стоят на своих местах.
+template <typename T, typename Less>
+T* partitionLeft(T* first, T* last, Less less) {
+    T pivot = *first;
+    T* left = first;
+    T* right = last;
+    while (less(pivot, *--right)) {}
+    if (right + 1 == last) {
+        while (left < right && !less(pivot, *++left)) {}
+    } else {
+        while (!less(pivot, *++left)) {}
+    }
+    while (left < right) {
+        std::swap(*left, *right);
+        while (less(pivot, *--right)) {}
+        while (!less(pivot, *++left)) {}
+    }
+    *first = *right;
+    *right = pivot;
+    return right;
+}
+
+template <typename T, typename Less>
+void introSortLoop(T* first, T* last, int badAllowed, bool leftmost, Less less) {
+    while (true) {
+        size_t n = last - first;
+        if (n < INSERTION_SORT_THRESHOLD) {
+            insertionSort(first, last, less);
+            return;
+        }
+
+        size_t half = n / 2;
+        if (n > NINTHER_THRESHOLD) {
+            sort3(first, first + half, last - 1, less);
+            sort3(first + 1, first + (half - 1), last - 2, less);
+            sort3(first + 2, first + (half + 1), last - 3, less);
+            sort3(first + (half - 1), first + half, first + (half + 1), less);
+            std::swap(*first, *(first + half));
+        } else {
+            sort3(first + half, first, last - 1, less);
+        }
+
+        if (!leftmost && !less(*(first - 1), *first)) {
+            first = partitionLeft(first, last, less) + 1;
+            continue;
+        }
+
+        auto split = partitionRight(first, last, less);
+        T* pivotPos = split.first;
+        size_t leftSize = pivotPos - first;
+        size_t rightSize = last - (pivotPos + 1);
+
+        if (leftSize < n / 8 || rightSize < n / 8) {
+            if (--badAllowed == 0) {
+                std::make_heap(first, last, less);
+                std::sort_heap(first, last, less);
+                return;
+            }
+            // ломаем закономерность, которая привела к плохому разбиению
+            if (leftSize >= INSERTION_SORT_THRESHOLD) {
+                std::swap(*first, *(first + leftSize / 4));
+                std::swap(*(pivotPos - 1), *(pivotPos - leftSize / 4));
+            }
+            if (rightSize >= INSERTION_SORT_THRESHOLD) {
+                std::swap(*(pivotPos + 1), *(pivotPos + 1 + rightSize / 4));
+                std::swap(*(last - 1), *(last - rightSize / 4));
+            }
+        } else if (split.second && partialInsertionSort(first, pivotPos, less) &&
+                   partialInsertionSort(pivotPos + 1, last, less)) {
+            return;
+        }
+
+        // рекурсия в меньшую часть, цикл по большей
+        if (leftSize < rightSize) {
+            introSortLoop(first, pivotPos, badAllowed, leftmost, less);
+            first = pivotPos + 1;
+            leftmost = false;
+        } else {
+            introSortLoop(pivotPos + 1, last, badAllowed, false, less);
+            last = pivotPos;
+        }
+    }
+}
+
+template <typename T, typename Less>
+void introSort(T* first, T* last, Less less) {
+    size_t n = last - first;
+    int log2n = 0;
+    while (n >>= 1) ++log2n;
+    introSortLoop(first, last, std::max(log2n, 1), true, less);
+}
+
+// LSD-сортировка записей по ключу key - minKey шириной width бит; scratch - буфер того же размера
+template <typename Spec>
+void radixSort(typename Spec::RecordType* data, size_t n, typename Spec::Key minKey, unsigned width,
+               typename Spec::RecordType* scratch) {
+    using Record = typename Spec::RecordType;
+    using UKey = typename std::make_unsigned<typename Spec::Key>::type;
+    const unsigned passes = (width + 7) / 8;
+    const UKey base = static_cast<UKey>(minKey);
+    auto digits = [base](const Record& r) { return static_cast<UKey>(static_cast<UKey>(Spec::key(r)) - base); };
+
+    // гистограммы всех цифр за один проход
+    std::vector<size_t> counts(passes * 256, 0);
+    for (size_t i = 0; i < n; ++i) {
+        UKey key = digits(data[i]);
+        for (unsigned p = 0; p < passes; ++p)
+            ++counts[p * 256 + ((key >> (8 * p)) & 0xFF)];
+    }
+
+    Record* src = data;
+    Record* dst = scratch;
+    for (unsigned p = 0; p < passes; ++p) {
+        size_t* count = &counts[p * 256];
+        if (count[(digits(src[0]) >> (8 * p)) & 0xFF] == n) continue;
+
+        size_t offset = 0;
+        for (size_t d = 0; d < 256; ++d) {
+            size_t c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; ++i)
+            dst[count[(digits(src[i]) >> (8 * p)) & 0xFF]++] = src[i];
+        std::swap(src, dst);
+    }
+    if (src != data)
+        std::copy(src, src + n, data);
+}
+
+// radix выгоднее сравнений, когда проходов по данным не больше ~log2(n)/3
+bool preferRadix(size_t n, unsigned width) {
+    if (n < RADIX_SORT_THRESHOLD) return false;
+    unsigned log2n = 0;
+    while (n >>= 1) ++log2n;
+    return (width + 7) / 8 <= std::max(1u, log2n / 3);
+}
+
+// scratch - вспомогательный буфер radix не меньше data.size() записей, без него
+// (nullptr) radix не выбирается; shortcut - не сортировать уже упорядоченный (или
+// упорядоченный наоборот) прогон; сравнение ядер отключает его, чтобы мерить само ядро
+template <typename Spec>
+void sortRun(std::vector<typename Spec::RecordType>& data, typename Spec::RecordType* scratch,
+             SortKernel kernel = sortKernel, bool shortcut = true) {
+    using Record = typename Spec::RecordType;
+    using Key = typename Spec::Key;
+    size_t n = data.size();
+    if (n < 2) return;
+    if constexpr (std::is_same<Record, int>::value) {
+        if (kernel == SortKernel::Quick) {
+            quickSort(data, 0, n - 1);
+            return;
+        }
+    }
+    auto less = [](const Record& a, const Record& b) { return Spec::recordLess(a, b); };
+
+    Key lo = Spec::key(data[0]);
+    Key hi = lo;
+    size_t descents = 0;
+    size_t ascents = 0;
+    for (size_t i = 1; i < n; ++i) {
+        Key k = Spec::key(data[i]);
+        if (Spec::less(k, lo)) lo = k;
+        if (Spec::less(hi, k)) hi = k;
+        descents += less(data[i], data[i - 1]);
+        ascents += less(data[i - 1], data[i]);
+    }
+    if (shortcut && descents == 0) return;
+    if (shortcut && ascents == 0) {
+        std::reverse(data.begin(), data.end());
+        return;
+    }
+
+    if constexpr (Spec::integralKey) {
+        using UKey = typename std::make_unsigned<Key>::type;
+        uint64_t range = static_cast<UKey>(static_cast<UKey>(hi) - static_cast<UKey>(lo));
+        unsigned width = range ? 64 - __builtin_clzll(range) : 0;
+        if (kernel == SortKernel::Auto)
+            kernel = preferRadix(n, width) ? SortKernel::Radix : SortKernel::Intro;
+        if (kernel == SortKernel::Radix && scratch) {
+            radixSort<Spec>(data.data(), n, lo, width, scratch);
+            return;
+        }
+    }
+    introSort(data.data(), data.data() + n, less);
+}
+
+// Вспомогательный буфер radix на capacity записей или nullptr, если ядро radix не
+// выберет. Не заполняется: страницы занимаются только при первой записи в них.
+template <typename Spec>
+std::unique_ptr<typename Spec::RecordType[]> radixScratch(size_t capacity) {
+    using Record = typename Spec::RecordType;
+    if (!Spec::integralKey || (sortKernel != SortKernel::Auto && sortKernel != SortKernel::Radix)) return nullptr;
+    return std::unique_ptr<Record[]>(new Record[capacity]);
+}
+
+// Память прогона: буфер записей и рядом вспомогательный буфер radix, по capacity
+// записей (makeSortConfig делит между ними память прогона поровну). Выделяются при
+// первом обращении один раз на фазу и переиспользуются всеми ее прогонами и бакетами:
+// буферы, освобожденные и выделенные заново под каждый бакет, копились бы в куче.
+// release() отдает память шагу, которому нужен весь бюджет (распределению, слиянию).
+template <typename Spec>
+class RunMemory {
+    using Record = typename Spec::RecordType;
+
+public:
+    explicit RunMemory(size_t capacity) : limit(capacity) {}
+
+    size_t capacity() const {
+        return limit;
+    }
+
+    std::vector<Record>& data() {
+        if (buffer.capacity() < limit) buffer.reserve(limit);
+        return buffer;
+    }
+
+    Record* scratch() {
+        if (!radix) radix = radixScratch<Spec>(limit);
+        return radix.get();
+    }
+
+    void release() {
+        std::vector<Record>().swap(buffer);
+        radix.reset();
+    }
+
+    RunMemory(const RunMemory&) = delete;
+    RunMemory& operator=(const RunMemory&) = delete;
+
+private:
+    size_t limit;
+    std::vector<Record> buffer;
+    std::unique_ptr<Record[]> radix;
+};
+
+// Сравнение ядер на прогонах разной структуры: время на элемент, нс. Выбранные явно
+// ядра сортируют и упорядоченные прогоны; auto - как при обычном запуске, с проверкой
+// на упорядоченность.
+void benchmarkKernels(size_t n) {
+    std::mt19937 gen(42);
+    std::vector<std::pair<const char*, std::vector<int>>> inputs;
+    std::vector<int> random(n);
+    for (auto& v : random) v = static_cast<int>(gen());
+    std::vector<int> sorted = random;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int> reversed(sorted.rbegin(), sorted.rend());
+    std::vector<int> fewUnique(n);
+    for (auto& v : fewUnique) v = gen() % 16;
+    std::vector<int> narrow(n);
+    for (auto& v : narrow) v = gen() % 65536;
+    inputs.push_back({"sorted", sorted});
+    inputs.push_back({"reversed", reversed});
+    inputs.push_back({"all equal", std::vector<int>(n, 7)});
+    inputs.push_back({"random", random});
+    inputs.push_back({"16 distinct", fewUnique});
+    inputs.push_back({"16-bit keys", narrow});
+
+    std::vector<int> scratch(n);
+
+    const std::pair<const char*, SortKernel> kernels[] = {
+        {"quick", SortKernel::Quick}, {"intro", SortKernel::Intro},
+        {"radix", SortKernel::Radix}, {"auto", SortKernel::Auto}};
+
+    printf("%-14s", "ns/element");
+    for (const auto& k : kernels) printf(" %10s", k.first);
+    printf("\n");
+    for (const auto& input : inputs) {
+        printf("%-14s", input.first);
+        for (const auto& k : kernels) {
+            std::vector<int> data = input.second;
+            auto start = std::chrono::steady_clock::now();
+            sortRun<IntSpec>(data, scratch.data(), k.second, k.second == SortKernel::Auto);
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            if (!std::is_sorted(data.begin(), data.end())) {
+                fprintf(stderr, "Ядро %s отсортировало неверно\n", k.first);
+                exit(1);
+            }
+            printf(" %10.2f", elapsed.count() / n);
+        }
+        printf("\n");
+    }
+}
+
+// Трехстадийный конвейер: produce() в потоке чтения заполняет задание, process()
+// выполняется пулом из workers потоков (второй аргумент - номер потока пула, по нему
+// выбирается его собственный рабочий буфер), consume() в потоке записи получает
+// результаты строго в порядке их создания. Задания - slots вызывающего: их буферы
+// выделяются один раз на фазу и только переиспользуются, в работе одновременно не
+// больше slots.size() заданий. Конвейер завершается, когда produce() вернет false
+// и все задания будут выведены.
+template <typename Task>
+void runPipeline(size_t workers, std::vector<Task>& slots,
+                 const std::function<bool(Task&)>& produce,
+                 const std::function<void(Task&, size_t)>& process,
+                 const std::function<void(Task&)>& consume) {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::pair<size_t, Task*>> pending;
+    std::map<size_t, Task*> done;
+    std::vector<Task*> spare;
+    for (Task& slot : slots) spare.push_back(&slot);
+    size_t produced = 0;
+    size_t consumed = 0;
+    bool producerDone = false;
+
+    std::thread reader([&] {
+        while (true) {
+            Task* task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !spare.empty(); });
+                task = spare.back();
+                spare.pop_back();
+            }
+            bool more = produce(*task);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!more) {
+                spare.push_back(task);
+                producerDone = true;
+                changed.notify_all();
+                return;
+            }
+            pending.emplace_back(produced++, task);
+            changed.notify_all();
+        }
+    });
+
+    std::vector<std::thread> pool;
+    for (size_t w = 0; w < workers; ++w) {
+        pool.emplace_back([&, w] {
+            while (true) {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !pending.empty() || producerDone; });
+                if (pending.empty()) return;
+                auto item = pending.front();
+                pending.pop_front();
+                lock.unlock();
+
+                process(*item.second, w);
+
+                lock.lock();
+                done.emplace(item.first, item.second);
+                changed.notify_all();
+            }
+        });
+    }
+
+    std::thread writer([&] {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] {
+                return done.count(consumed) > 0 || (producerDone && consumed == produced);
+            });
+            auto it = done.find(consumed);
+            if (it == done.end()) return;
+            Task* task = it->second;
+            done.erase(it);
+            lock.unlock();
+
+            consume(*task);
+
+            lock.lock();
+            spare.push_back(task);
+            ++consumed;
+            changed.notify_all();
+        }
+    });
+
+    reader.join();
+    for (auto& t : pool) t.join();
+    writer.join();
+}
+
+template <typename Source, typename Record>
+size_t readChunk(Source& in, std::vector<Record>& buffer, size_t size) {
     buffer.clear();
-    int x;
-    for (size_t i = 0; i < size && fscanf(in, "%d", &x) == 1; ++i)
+    Record x;
+    for (size_t i = 0; i < size && in.next(x); ++i)
         buffer.push_back(x);
     return buffer.size();
 }
 
-int createSortedChunks(const char* input_file) {
-    FILE* in = openFile(input_file, "r");
-    std::vector<int> buffer;
-    int chunkIndex = 0;
+// Бинарный вход читается целыми блоками, без поэлементного разбора. Буфер растет
+// вдвое по мере чтения, чтобы короткий вход не занимал память целого прогона.
+template <typename Record>
+size_t readChunk(RecordReader<Record>& in, std::vector<Record>& buffer, size_t size) {
+    buffer.clear();
+    while (buffer.size() < size) {
+        size_t have = buffer.size();
+        size_t want = std::min(size - have, std::max<size_t>(have, 1 << 16));
+        buffer.resize(have + want);
+        size_t got = in.read(buffer.data() + have, want);
+        buffer.resize(have + got);
+        if (got < want) break;
+    }
+    return buffer.size();
+}
+
+std::string chunkName(size_t index) {
+    return spill.path("chunk_" + std::to_string(index) + ".bin");
+}
+
+// единственный проход по входу: режем на прогоны, сортируем, пишем в бинарном виде;
+// в один поток прогоны занимают memory, в несколько - буферы конвейера
+template <typename Spec, typename Source>
+size_t createSortedChunks(Source& in, RunMemory<Spec>& memory) {
+    using Record = typename Spec::RecordType;
+    size_t chunkIndex = 0;
+
+    if (sortConfig.threads > 1) {
+        const size_t capacity = workCapacity<Record>();
+        std::vector<std::vector<Record>> slots(sortConfig.threads + 2);
+        for (auto& buffer : slots) buffer.reserve(capacity);
+        std::vector<std::unique_ptr<Record[]>> scratch(sortConfig.threads);
+        for (auto& buffer : scratch) buffer = radixScratch<Spec>(capacity);
+        runPipeline<std::vector<Record>>(sortConfig.threads, slots,
+            [&](std::vector<Record>& buffer) {
+                return readChunk(in, buffer, capacity) > 0;
+            },
+            [&](std::vector<Record>& buffer, size_t worker) {
+                sortRun<Spec>(buffer, scratch[worker].get());
+            },
+            [&](std::vector<Record>& buffer) {
+                RecordWriter<Record> out(chunkName(chunkIndex++).c_str());
+                out.write(buffer.data(), buffer.size());
+            });
+        return chunkIndex;
+    }
 
-    while (readChunk(in, buffer, MEMORY_LIMIT) > 0) {
-        quickSort(buffer, 0, buffer.size() - 1);
-        char chunkName[64];
-        sprintf(chunkName, "chunk_%d.txt", chunkIndex);
-        FILE* out = openFile(chunkName, "w");
-        for (size_t x : buffer) fprintf(out, "%d ", x);
-        fclose(out);
+    std::vector<Record>& buffer = memory.data();
+    while (readChunk(in, buffer, memory.capacity()) > 0) {
+        sortRun<Spec>(buffer, memory.scratch());
+        RecordWriter<Record> out(chunkName(chunkIndex).c_str());
+        out.write(buffer.data(), buffer.size());
         ++chunkIndex;
     }
 
-    fclose(in);
     return chunkIndex;
 }
 
-std::vector<int> selectPivots(size_t numChunks, size_t dist) {
-    std::vector<int> sample;
-    for (size_t i = 0; i < numChunks; ++i) {
-        char fname[64];
-        sprintf(fname, "chunk_%zu.txt", i);
-        FILE* f = openFile(fname, "r");
-        int x, count = 0;
-        while (fscanf(f, "%d", &x) == 1) {
-            if (count++ % dist == 0) sample.push_back(x);
+// число разделителей: бакеты в среднем вдвое меньше прогона, но не больше допустимого fan-out
+template <typename Record>
+size_t pivotCount(size_t elements) {
+    size_t wanted = 2 * (elements / runCapacity<Record>() + 1);
+    return std::min(wanted, sortConfig.maxFanOut) - 1;
+}
+
+// Разделители и признак бакета равных для каждого из них. Ключ, который
+// занимает в выборке не меньше доли одного бакета, получает отдельный бакет
+// равных: такой бакет не сортируется и не делится дальше, а сразу выводится.
+// Всего бакетов (pivots + heavy + 1) не больше sortConfig.maxFanOut: все они
+// открыты одновременно.
+template <typename Key>
+struct Splitters {
+    std::vector<Key> pivots;
+    std::vector<char> heavy;
+};
+
+// Выборка с избытком: oversample элементов на бакет, где oversample растет как
+// log2(n). При такой выборке бакеты диапазонов с высокой вероятностью не больше
+// (1 + eps) n / k; если какой-то все же вырос, он делится на следующем уровне,
+// а на пределе рекурсии сортируется слиянием, так что память остается ограниченной.
+// Выборка равномерна по всем файлам сразу (reservoir sampling, алгоритм L):
+// число пропускаемых элементов до следующей замены разыгрывается сразу.
+template <typename Spec>
+Splitters<typename Spec::Key> selectPivots(const std::vector<std::string>& files, size_t elements,
+                                           size_t numPivots) {
+    using Record = typename Spec::RecordType;
+    using Key = typename Spec::Key;
+    size_t log2n = 1;
+    while ((size_t(1) << log2n) < elements) ++log2n;
+    size_t oversample = std::max<size_t>(16, 2 * log2n);
+    size_t sampleSize = std::max<size_t>(1, std::min(oversample * (numPivots + 1), runCapacity<Record>() / 4));
+
+    std::vector<Key> sample;
+    sample.reserve(sampleSize);
+    std::mt19937_64 gen(elements);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    auto draw = [&] { return std::max(uniform(gen), std::numeric_limits<double>::min()); };
+    double w = std::exp(std::log(draw()) / sampleSize);
+    size_t skip = 0;
+    for (const auto& fname : files) {
+        RecordReader<Record> f(fname.c_str());
+        Record x;
+        while (f.next(x)) {
+            if (sample.size() < sampleSize) {
+                sample.push_back(Spec::key(x));
+                if (sample.size() == sampleSize)
+                    skip = static_cast<size_t>(std::log(draw()) / std::log1p(-w));
+            } else if (skip > 0) {
+                --skip;
+            } else {
+                sample[gen() % sampleSize] = Spec::key(x);
+                w *= std::exp(std::log(draw()) / sampleSize);
+                skip = static_cast<size_t>(std::log(draw()) / std::log1p(-w));
+            }
         }
-        fclose(f);
     }
 
-    if (!sample.empty())
-        quickSort(sample, 0, sample.size() - 1);
+    Splitters<Key> result;
+    if (sample.empty()) return result;
+    introSort(sample.data(), sample.data() + sample.size(), Spec::less);
 
-    std::vector<int> pivots;
-    for (int i = 1; i <= NUM_PIVOTS; ++i) {
-        size_t idx = sample.size() * i / (NUM_PIVOTS + 1);
-        if (idx < sample.size()) pivots.push_back(sample[idx]);
+    // повторяющиеся разделители схлопываются в один с бакетом равных
+    size_t share = std::max<size_t>(1, sample.size() / (numPivots + 1));
+    std::vector<std::pair<size_t, size_t>> heavyCounts; // (число в выборке, номер разделителя)
+    for (size_t i = 1; i <= numPivots; ++i) {
+        size_t idx = sample.size() * i / (numPivots + 1);
+        if (idx >= sample.size()) break;
+        const Key& key = sample[idx];
+        if (!result.pivots.empty() && !Spec::less(result.pivots.back(), key)) continue;
+        auto range = std::equal_range(sample.begin(), sample.end(), key, Spec::less);
+        size_t count = range.second - range.first;
+        if (count >= share) heavyCounts.push_back({count, result.pivots.size()});
+        result.pivots.push_back(key);
+        result.heavy.push_back(count >= share);
     }
 
-    return pivots;
+    // бакетов равных сверх fan-out не заводим: самые легкие из тяжелых ключей
+    // остаются в бакетах диапазонов и при необходимости делятся на следующем уровне
+    size_t buckets = result.pivots.size() + heavyCounts.size() + 1;
+    if (buckets > sortConfig.maxFanOut) {
+        std::sort(heavyCounts.begin(), heavyCounts.end());
+        for (size_t i = 0; i < buckets - sortConfig.maxFanOut; ++i) result.heavy[heavyCounts[i].second] = 0;
+    }
+    return result;
 }
 
-void distributeToBuckets(const char* input_file, const std::vector<int>& pivots,
-                         const std::vector<std::string>& bucket_files) {
-    FILE* in = openFile(input_file, "r");
-    std::vector<FILE*> buckets;
+// Поиск бакета без ветвлений, как в super-scalar samplesort: разделители лежат
+// неявным деревом поиска в порядке Эйтцингера (дети узла j - 2j и 2j+1), спуск
+// j = 2j + (x > tree[j]) занимает log2(k) шагов без переходов. Пачка элементов
+// спускается одновременно, уровень за уровнем, поэтому загрузки независимы и
+// перекрываются в конвейере процессора. Номер диапазона b - число разделителей,
+// меньших x; затем одно сравнение x == pivots[b] отправляет тяжелые ключи в
+// бакет равных. Бакеты пронумерованы в порядке вывода: диапазон 0, равные
+// pivots[0] (если заведен), диапазон 1 и т.д.
+template <typename Spec>
+class BucketClassifier {
+    using Record = typename Spec::RecordType;
+    using Key = typename Spec::Key;
 
-    for (const auto& fname : bucket_files)
-        buckets.push_back(openFile(fname.c_str(), "w"));
+public:
+    static const size_t BATCH = 16;
+
+    explicit BucketClassifier(const Splitters<Key>& splitters)
+        : levels(0), lastBucket(splitters.pivots.size()), equalKeys(splitters.pivots), heavy(splitters.heavy) {
+        const std::vector<Key>& pivots = splitters.pivots;
+        size_t leaves = 1;
+        while (leaves < pivots.size() + 1) {
+            leaves *= 2;
+            ++levels;
+        }
+        // недостающие разделители повторяют последний, а номера бакетов за ним
+        // обрезаются до lastBucket: так не нужен ключ-максимум для каждого типа
+        std::vector<Key> padded(pivots);
+        if (!pivots.empty()) padded.resize(leaves - 1, pivots.back());
+        tree.assign(leaves, Key());
+        size_t next = 0;
+        build(padded, next, 1);
+
+        // за последним диапазоном разделителя нет: сравнение с ним всегда ложно
+        equalKeys.push_back(pivots.empty() ? Key() : pivots.back());
+        heavy.push_back(0);
+        slots.resize(2 * (lastBucket + 1));
+        size_t slot = 0;
+        for (size_t b = 0; b <= lastBucket; ++b) {
+            slots[2 * b] = slot++;
+            slots[2 * b + 1] = heavy[b] ? slot++ : slots[2 * b];
+        }
+        equalBucket.assign(slot, false);
+        for (size_t b = 0; b < lastBucket; ++b)
+            if (heavy[b]) equalBucket[slots[2 * b + 1]] = true;
+    }
+
+    size_t bucketCount() const {
+        return equalBucket.size();
+    }
+
+    // бакет равных выводится как есть, без сортировки
+    bool isEqualityBucket(size_t bucket) const {
+        return equalBucket[bucket];
+    }
 
-    int x;
-    while (fscanf(in, "%d", &x) == 1) {
+    size_t classify(const Record& x) const {
+        Key key = Spec::key(x);
+        size_t j = 1;
+        for (size_t l = 0; l < levels; ++l)
+            j = 2 * j + Spec::less(tree[j], key);
+        return slot(std::min(j - tree.size(), lastBucket), key);
+    }
+
+    void classify(const Record* x, size_t count, uint32_t* bucket) const {
         size_t i = 0;
-        while (i < pivots.size() && x > pivots[i]) ++i;
-        fprintf(buckets[i], "%d ", x);
+        for (; i + BATCH <= count; i += BATCH) {
+            Key key[BATCH];
+            size_t j[BATCH];
+            for (size_t b = 0; b < BATCH; ++b) {
+                key[b] = Spec::key(x[i + b]);
+                j[b] = 1;
+            }
+            for (size_t l = 0; l < levels; ++l)
+                for (size_t b = 0; b < BATCH; ++b)
+                    j[b] = 2 * j[b] + Spec::less(tree[j[b]], key[b]);
+            for (size_t b = 0; b < BATCH; ++b)
+                bucket[i + b] = slot(std::min(j[b] - tree.size(), lastBucket), key[b]);
+        }
+        for (; i < count; ++i)
+            bucket[i] = classify(x[i]);
+    }
+
+private:
+    // x <= pivots[b] уже известно, поэтому равенство - это !(x < pivots[b])
+    size_t slot(size_t b, const Key& key) const {
+        size_t equal = heavy[b] & !Spec::less(key, equalKeys[b]);
+        return slots[2 * b + equal];
+    }
+
+    // симметричный обход дерева раскладывает отсортированные разделители по узлам
+    void build(const std::vector<Key>& sorted, size_t& next, size_t node) {
+        if (node >= tree.size()) return;
+        build(sorted, next, 2 * node);
+        tree[node] = sorted[next++];
+        build(sorted, next, 2 * node + 1);
+    }
+
+    size_t levels;
+    size_t lastBucket;
+    std::vector<Key> tree;
+    std::vector<Key> equalKeys;
+    std::vector<char> heavy;
+    std::vector<uint32_t> slots;
+    std::vector<bool> equalBucket;
+};
+
+template <typename Spec>
+void distributeToBuckets(const std::vector<std::string>& input_files, const BucketClassifier<Spec>& classifier,
+                         const std::vector<std::string>& bucket_files) {
+    using Record = typename Spec::RecordType;
+    // буферы бакетов делят между собой половину бюджета памяти
+    size_t bucketBuffer = std::max(IO_ALIGNMENT, sortConfig.memoryBytes / 2 / bucket_files.size());
+    std::vector<std::unique_ptr<RecordWriter<Record>>> buckets;
+    for (const auto& fname : bucket_files)
+        buckets.emplace_back(new RecordWriter<Record>(fname.c_str(), bucketBuffer));
+
+    const size_t batch = 1024;
+    std::vector<Record> values(batch);
+    uint32_t ids[batch];
+    for (const auto& input : input_files) {
+        RecordReader<Record> in(input.c_str());
+        size_t n;
+        while ((n = in.read(values.data(), batch)) > 0) {
+            classifier.classify(values.data(), n, ids);
+            for (size_t i = 0; i < n; ++i)
+                buckets[ids[i]]->put(values[i]);
+        }
     }
+}
 
-    for (auto f : buckets) fclose(f);
-    fclose(in);
+// имена бакетов одного разбиения, в порядке вывода
+std::vector<std::string> bucketNames(const std::string& prefix, size_t count) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < count; ++i)
+        names.push_back(spill.path(prefix + std::to_string(i) + ".bin"));
+    return names;
 }
 
-void sortAndWriteToOutput(FILE* out, const std::string& filename, int recursion_level = 0) {
-    FILE* in = openFile(filename.c_str(), "r");
-    std::vector<int> data;
-    int x;
-    while (fscanf(in, "%d", &x) == 1)
-        data.push_back(x);
-    fclose(in);
-    remove(filename.c_str());
+template <typename Spec>
+std::vector<std::string> mergePasses(std::vector<std::string> runs, size_t fan_in, size_t memory);
+
+template <typename Spec, typename Writer>
+void mergeRuns(const std::vector<std::string>& runs, Writer& out, size_t memory);
 
-    if (data.size() <= MEMORY_LIMIT || recursion_level >= MAX_RECURSION_DEPTH) {
-        quickSort(data, 0, data.size() - 1);
-        for (int v : data) fprintf(out, "%d ", v);
+// Бакет равных ключей выводится потоком, без загрузки в память.
+template <typename Spec, typename Sink>
+void copyToOutput(Sink& out, const std::string& filename) {
+    using Record = typename Spec::RecordType;
+    RecordReader<Record> in(filename.c_str());
+    Record x;
+    while (in.next(x)) out.put(x);
+}
+
+// memory - общая память прогона для всех бакетов фазы
+template <typename Spec, typename Sink>
+void sortAndWriteToOutput(Sink& out, const std::string& filename, RunMemory<Spec>& memory,
+                          int recursion_level = 0) {
+    using Record = typename Spec::RecordType;
+    size_t size = RecordReader<Record>::count(filename.c_str());
+
+    if (size <= memory.capacity()) {
+        std::vector<Record>& data = memory.data();
+        data.resize(size);
+        {
+            RecordReader<Record> in(filename.c_str());
+            data.resize(in.read(data.data(), size));
+        }
+        remove(filename.c_str());
+        sortRun<Spec>(data, memory.scratch());
+        for (const Record& v : data) out.put(v);
+        return;
+    }
+
+    // Разбиение не сходится (например, ключи почти равны, но не совпадают):
+    // сортируем бакет слиянием прогонов. Выход уже пишется и занимает свой блок,
+    // поэтому прогоны короче на блок файла прогона, а слиянию достается бюджет без
+    // блока выхода - так память не выходит за бюджет.
+    if (recursion_level >= MAX_RECURSION_DEPTH) {
+        memory.release();
+        std::vector<std::string> runs;
+        {
+            RunMemory<Spec> nested(nestedRunCapacity<Record>());
+            RecordReader<Record> in(filename.c_str());
+            size_t numChunks = createSortedChunks<Spec>(in, nested);
+            for (size_t i = 0; i < numChunks; ++i)
+                runs.push_back(chunkName(i));
+        }
+        remove(filename.c_str());
+        const size_t mergeMemory = sortConfig.memoryBytes - sortConfig.ioBlockSize;
+        runs = mergePasses<Spec>(runs, sortConfig.maxFanOut, mergeMemory);
+        mergeRuns<Spec>(runs, out, mergeMemory);
+        for (const auto& run : runs)
+            remove(run.c_str());
         return;
     }
 
-    char tmp_input[64];
-    sprintf(tmp_input, "rec_input_%d.txt", recursion_level);
-    FILE* tmp = openFile(tmp_input, "w");
-    for (int v : data) fprintf(tmp, "%d ", v);
-    fclose(tmp);
+    // бакет уже лежит на диске в бинарном виде, делим его напрямую; выборке и
+    // буферам бакетов нужна память прогона
+    memory.release();
+    std::vector<std::string> input = {filename};
+    BucketClassifier<Spec> classifier(selectPivots<Spec>(input, size, pivotCount<Record>(size)));
+    std::vector<std::string> bucket_files = bucketNames("bucket_" + std::to_string(recursion_level) + "_",
+                                                        classifier.bucketCount());
 
-    std::vector<int> pivots = selectPivots(1, data.size() / NUM_PIVOTS);
-    std::vector<std::string> bucket_files;
-    for (size_t i = 0; i <= pivots.size(); ++i) {
-        char fname[64];
-        sprintf(fname, "bucket_%d_%zu.txt", recursion_level, i);
-        bucket_files.push_back(fname);
+    distributeToBuckets<Spec>(input, classifier, bucket_files);
+    remove(filename.c_str());
+
+    for (size_t i = 0; i < bucket_files.size(); ++i) {
+        if (classifier.isEqualityBucket(i))
+            copyToOutput<Spec>(out, bucket_files[i]);
+        else
+            sortAndWriteToOutput<Spec>(out, bucket_files[i], memory, recursion_level + 1);
+        remove(bucket_files[i].c_str());
     }
+}
+
+template <typename Record>
+struct BucketTask {
+    size_t index;
+    bool equality;
+    std::vector<Record> data;
+};
+
+// Бакеты читаются, сортируются пулом потоков и выводятся в исходном порядке.
+// Бакет равных копируется в потоке записи. Бакет, не помещающийся в буфер
+// конвейера, делится рекурсивно с памятью целого прогона, поэтому перед ним
+// конвейер дорабатывает и отдает свои буферы, а после него запускается снова.
+template <typename Spec, typename Sink>
+void sortBucketsParallel(Sink& out, const std::vector<std::string>& bucket_files,
+                         const BucketClassifier<Spec>& classifier) {
+    using Record = typename Spec::RecordType;
+    const size_t capacity = workCapacity<Record>();
+    std::vector<BucketTask<Record>> slots(sortConfig.threads + 2);
+    std::vector<std::unique_ptr<Record[]>> scratch(sortConfig.threads);
+    RunMemory<Spec> memory(runCapacity<Record>());
+    auto oversized = [&](size_t index) {
+        return !classifier.isEqualityBucket(index) &&
+               RecordReader<Record>::count(bucket_files[index].c_str()) > capacity;
+    };
 
-    distributeToBuckets(tmp_input, pivots, bucket_files);
-    remove(tmp_input);
+    size_t next = 0;
+    while (next < bucket_files.size()) {
+        for (auto& slot : slots) slot.data.reserve(capacity);
+        for (auto& buffer : scratch)
+            if (!buffer) buffer = radixScratch<Spec>(capacity);
+        runPipeline<BucketTask<Record>>(sortConfig.threads, slots,
+            [&](BucketTask<Record>& task) {
+                if (next == bucket_files.size() || oversized(next)) return false;
+                task.index = next++;
+                task.equality = classifier.isEqualityBucket(task.index);
+                task.data.clear();
+                if (!task.equality) {
+                    const char* name = bucket_files[task.index].c_str();
+                    size_t size = RecordReader<Record>::count(name);
+                    task.data.resize(size);
+                    RecordReader<Record> in(name);
+                    task.data.resize(in.read(task.data.data(), size));
+                }
+                return true;
+            },
+            [&](BucketTask<Record>& task, size_t worker) {
+                if (!task.equality)
+                    sortRun<Spec>(task.data, scratch[worker].get());
+            },
+            [&](BucketTask<Record>& task) {
+                const std::string& name = bucket_files[task.index];
+                if (task.equality) {
+                    copyToOutput<Spec>(out, name);
+                } else {
+                    for (const Record& v : task.data) out.put(v);
+                }
+                remove(name.c_str());
+            });
+        if (next == bucket_files.size()) break;
 
-    for (const auto& bucket : bucket_files) {
-        sortAndWriteToOutput(out, bucket, recursion_level + 1);
-        remove(bucket.c_str());
+        // конвейер стоит, его буферы не нужны до следующего запуска
+        for (auto& slot : slots) std::vector<Record>().swap(slot.data);
+        for (auto& buffer : scratch) buffer.reset();
+        sortAndWriteToOutput<Spec>(out, bucket_files[next], memory, 1);
+        remove(bucket_files[next].c_str());
+        memory.release();
+        ++next;
     }
 }
 
-void externalQuickSort(const char* input_file, const char* output_file) {
-    size_t numChunks = createSortedChunks(input_file);
-    size_t dist = MEMORY_LIMIT / NUM_PIVOTS;
-    std::vector<int> pivots = selectPivots(numChunks, dist);
+template <typename Spec, typename Source, typename Sink>
+void externalQuickSort(Source& in, Sink& out) {
+    using Record = typename Spec::RecordType;
+    size_t numChunks;
+    {
+        PhaseTimer phase("run generation");
+        RunMemory<Spec> memory(runCapacity<Record>());
+        numChunks = createSortedChunks<Spec>(in, memory);
+    }
 
-    std::vector<std::string> bucket_files;
-    for (size_t i = 0; i <= pivots.size(); ++i) {
-        char fname[64];
-        sprintf(fname, "level0_bucket_%zu.txt", i);
-        bucket_files.push_back(fname);
+    std::vector<std::string> chunk_files;
+    size_t elements = 0;
+    for (size_t i = 0; i < numChunks; ++i) {
+        chunk_files.push_back(chunkName(i));
+        elements += RecordReader<Record>::count(chunk_files.back().c_str());
     }
 
-    distributeToBuckets(input_file, pivots, bucket_files);
+    Splitters<typename Spec::Key> splitters;
+    {
+        PhaseTimer phase("pivot sampling");
+        splitters = selectPivots<Spec>(chunk_files, elements, pivotCount<Record>(elements));
+    }
 
-    FILE* out = openFile(output_file, "w");
-    for (const auto& bucket : bucket_files) {
-        sortAndWriteToOutput(out, bucket, 1);
-        remove(bucket.c_str());
+    BucketClassifier<Spec> classifier(splitters);
+    std::vector<std::string> bucket_files = bucketNames("level0_bucket_", classifier.bucketCount());
+
+    // прогоны содержат те же данные, что и вход, но уже в бинарном виде
+    {
+        PhaseTimer phase("distribution");
+        distributeToBuckets<Spec>(chunk_files, classifier, bucket_files);
     }
 
-    for (size_t i = 0; i < numChunks; ++i) {
-        char chunkName[64];
-        sprintf(chunkName, "chunk_%zu.txt", i);
-        remove(chunkName);
+    for (const auto& chunk : chunk_files)
+        remove(chunk.c_str());
+
+    {
+        PhaseTimer phase("bucket sort + output");
+        if (sortConfig.threads > 1) {
+            sortBucketsParallel<Spec>(out, bucket_files, classifier);
+        } else {
+            RunMemory<Spec> memory(runCapacity<Record>());
+            for (size_t i = 0; i < bucket_files.size(); ++i) {
+                if (classifier.isEqualityBucket(i))
+                    copyToOutput<Spec>(out, bucket_files[i]);
+                else
+                    sortAndWriteToOutput<Spec>(out, bucket_files[i], memory, 1);
+                remove(bucket_files[i].c_str());
+            }
+        }
+        out.close();
+    }
+}
+
+// Дерево проигравших для k-путевого слияния: во внутренних узлах хранятся
+// проигравшие, в tree[0] - победитель. После извлечения минимума переигрывается
+// только путь от листа победителя до корня, т.е. log2(k) сравнений.
+template <typename Spec>
+class LoserTree {
+    using Record = typename Spec::RecordType;
+    using Key = typename Spec::Key;
+
+public:
+    explicit LoserTree(std::vector<std::unique_ptr<RecordReader<Record>>>& sources)
+        : sources(sources), k(sources.size()), heads(k), keys(k), alive(k), tree(std::max<size_t>(k, 1)) {
+        for (size_t i = 0; i < k; ++i)
+            advance(i);
+        if (k == 0) return;
+
+        // строим снизу вверх: листья лежат на позициях k..2k-1
+        std::vector<size_t> winners(2 * k);
+        for (size_t i = 0; i < k; ++i) winners[k + i] = i;
+        for (size_t node = k - 1; node >= 1; --node) {
+            size_t a = winners[2 * node];
+            size_t b = winners[2 * node + 1];
+            winners[node] = beats(a, b) ? a : b;
+            tree[node] = beats(a, b) ? b : a;
+        }
+        tree[0] = k == 1 ? 0 : winners[1];
+    }
+
+    bool next(Record& x) {
+        if (k == 0) return false;
+        size_t winner = tree[0];
+        if (!alive[winner]) return false;
+        x = heads[winner];
+        advance(winner);
+
+        for (size_t node = (winner + k) / 2; node > 0; node /= 2) {
+            if (beats(tree[node], winner))
+                std::swap(tree[node], winner);
+        }
+        tree[0] = winner;
+        return true;
+    }
+
+private:
+    // ключ текущей записи каждого источника кэшируется, чтобы не извлекать его при каждом сравнении
+    void advance(size_t i) {
+        alive[i] = sources[i]->next(heads[i]);
+        if (alive[i]) keys[i] = Spec::key(heads[i]);
+    }
+
+    // исчерпанный источник проигрывает всем, при равенстве ключей побеждает меньший индекс
+    bool beats(size_t a, size_t b) const {
+        if (alive[a] != alive[b]) return alive[a];
+        if (!alive[a]) return a < b;
+        return Spec::less(keys[a], keys[b]) || (!Spec::less(keys[b], keys[a]) && a < b);
+    }
+
+    std::vector<std::unique_ptr<RecordReader<Record>>>& sources;
+    size_t k;
+    std::vector<Record> heads;
+    std::vector<Key> keys;
+    std::vector<bool> alive;
+    std::vector<size_t> tree;
+};
+
+// входы слияния делят между собой memory байт
+template <typename Spec, typename Writer>
+void mergeRuns(const std::vector<std::string>& runs, Writer& out, size_t memory) {
+    using Record = typename Spec::RecordType;
+    size_t runBuffer = std::max(IO_ALIGNMENT, memory / std::max<size_t>(runs.size(), 1));
+    std::vector<std::unique_ptr<RecordReader<Record>>> sources;
+    for (const auto& run : runs)
+        sources.emplace_back(new RecordReader<Record>(run.c_str(), runBuffer));
+
+    LoserTree<Spec> tree(sources);
+    Record x;
+    while (tree.next(x))
+        out.put(x);
+}
+
+// Промежуточные проходы: группы по fan_in прогонов сливаются, пока прогонов больше fan_in.
+// memory - память прохода, из нее же буфер выхода.
+template <typename Spec>
+std::vector<std::string> mergePasses(std::vector<std::string> runs, size_t fan_in, size_t memory) {
+    using Record = typename Spec::RecordType;
+    for (int pass = 1; runs.size() > fan_in; ++pass) {
+        PhaseTimer phase("merge pass " + std::to_string(pass));
+        std::vector<std::string> merged;
+        for (size_t first = 0; first < runs.size(); first += fan_in) {
+            std::vector<std::string> group(runs.begin() + first,
+                                           runs.begin() + std::min(first + fan_in, runs.size()));
+            std::string fname = spill.path("merge_" + std::to_string(pass) + "_" +
+                                           std::to_string(merged.size()) + ".bin");
+            {
+                RecordWriter<Record> out(fname.c_str());
+                mergeRuns<Spec>(group, out, memory - sortConfig.ioBlockSize);
+            }
+            for (const auto& run : group)
+                remove(run.c_str());
+            merged.push_back(fname);
+        }
+        runs.swap(merged);
+    }
+    return runs;
+}
+
+// Сортировка слиянием: прогоны сливаются напрямую деревом проигравших. Если
+// прогонов больше, чем fan_in, выполняются промежуточные проходы слияния.
+// fan_in = 0 означает выбор по бюджету памяти.
+template <typename Spec, typename Source, typename Sink>
+void externalMergeSort(Source& in, Sink& out, size_t fan_in) {
+    using Record = typename Spec::RecordType;
+    if (fan_in == 0) fan_in = sortConfig.maxFanOut;
+    fan_in = std::max<size_t>(2, std::min(fan_in, maxOpenRuns()));
+
+    std::vector<std::string> runs;
+    {
+        PhaseTimer phase("run generation");
+        RunMemory<Spec> memory(runCapacity<Record>());
+        size_t numChunks = createSortedChunks<Spec>(in, memory);
+        for (size_t i = 0; i < numChunks; ++i)
+            runs.push_back(chunkName(i));
+    }
+
+    // выход открыт, но его буферы заняты только в последнем слиянии
+    runs = mergePasses<Spec>(runs, fan_in, sortConfig.memoryBytes);
+
+    {
+        PhaseTimer phase("final merge + output");
+        mergeRuns<Spec>(runs, out, sortConfig.memoryBytes - sortConfig.ioBlockSize);
+        out.close();
+    }
+
+    for (const auto& run : runs)
+        remove(run.c_str());
+}
+
+// Режим ключ-префикса для широких записей: сортируются пары (ключ, номер записи),
+// а сами записи переставляются один раз при выводе. Промежуточные проходы
+// перекладывают 16 байт на запись вместо sizeof(Record).
+
+// Ключ в беззнаковом виде с тем же порядком: у знаковых инвертируется знаковый бит.
+template <typename Key>
+uint64_t normalizeKey(Key key) {
+    using UKey = typename std::make_unsigned<Key>::type;
+    UKey u = static_cast<UKey>(key);
+    if (std::is_signed<Key>::value) u ^= UKey(1) << (8 * sizeof(Key) - 1);
+    return u;
+}
+
+template <typename Spec>
+class KeyRefSource {
+    using Record = typename Spec::RecordType;
+
+public:
+    explicit KeyRefSource(const char* name) : in(name), index(0) {}
+
+    bool next(KeyRef& ref) {
+        Record x;
+        if (!in.next(x)) return false;
+        ref.key = normalizeKey(Spec::key(x));
+        ref.index = index++;
+        return true;
+    }
+
+private:
+    RecordReader<Record> in;
+    uint64_t index;
+};
+
+// Принимает ссылки в порядке ключей и пишет соответствующие записи входа.
+// Ссылки копятся пачкой в четверть бюджета; внутри пачки записи выбираются
+// из отображенного входа в порядке смещений, чтобы чтение шло вперед.
+template <typename Record>
+class PermutingWriter {
+public:
+    PermutingWriter(const char* input_file, const char* output_file)
+        : out(output_file), mapped(nullptr), mappedBytes(0) {
+        int fd = openFile(input_file, O_RDONLY);
+        struct stat st;
+        if (fstat(fd, &st) != 0) ioError("Ошибка при открытии файла");
+        mappedBytes = st.st_size;
+        if (mappedBytes > 0) {
+            void* p = mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) ioError("Ошибка отображения входа");
+            mapped = static_cast<const Record*>(p);
+        }
+        ::close(fd);
+        batchLimit = std::max<size_t>(1, sortConfig.memoryBytes / 4 / (sizeof(KeyRef) + sizeof(Record)));
+        refs.reserve(batchLimit);
+    }
+
+    ~PermutingWriter() {
+        close();
+    }
+
+    void put(const KeyRef& ref) {
+        refs.push_back(ref);
+        if (refs.size() == batchLimit) flush();
     }
 
-    fclose(out);
+    void close() {
+        flush();
+        out.close();
+        if (mapped) munmap(const_cast<Record*>(mapped), mappedBytes);
+        mapped = nullptr;
+    }
+
+    PermutingWriter(const PermutingWriter&) = delete;
+    PermutingWriter& operator=(const PermutingWriter&) = delete;
+
+private:
+    void flush() {
+        if (refs.empty()) return;
+        // в refs.key больше не нужен ключ: кладем туда позицию в выходе
+        for (size_t i = 0; i < refs.size(); ++i) refs[i].key = i;
+        std::sort(refs.begin(), refs.end(),
+                  [](const KeyRef& a, const KeyRef& b) { return a.index < b.index; });
+        records.resize(refs.size());
+        for (const KeyRef& ref : refs)
+            records[ref.key] = toLittleEndian(mapped[ref.index]);
+        bytesReadTotal += refs.size() * sizeof(Record);
+        out.write(records.data(), records.size());
+        refs.clear();
+    }
+
+    RecordWriter<Record> out;
+    const Record* mapped;
+    size_t mappedBytes;
+    size_t batchLimit;
+    std::vector<KeyRef> refs;
+    std::vector<Record> records;
+};
+
+struct SortOptions {
+    bool mergeMode;
+    size_t fanIn;
+    bool keyPrefix;
+};
+
+template <typename Spec, typename Source, typename Sink>
+void runSort(Source& in, Sink& out, const SortOptions& options) {
+    if (options.mergeMode)
+        externalMergeSort<Spec>(in, out, options.fanIn);
+    else
+        externalQuickSort<Spec>(in, out);
 }
 
-int main() {
+// текстовый вход из int32, как в исходной постановке задачи
+void sortTextFile(const char* input_file, const char* output_file, const SortOptions& options) {
+    TextReader in(input_file);
+    TextWriter out(output_file);
+    runSort<IntSpec>(in, out, options);
+}
+
+// бинарный файл записей Spec::RecordType на входе и на выходе
+template <typename Spec>
+void sortRecordFile(const char* input_file, const char* output_file, const SortOptions& options) {
+    using Record = typename Spec::RecordType;
+    if constexpr (Spec::integralKey && sizeof(Record) > sizeof(KeyRef)) {
+        if (options.keyPrefix) {
+            KeyRefSource<Spec> in(input_file);
+            PermutingWriter<Record> out(input_file, output_file);
+            runSort<KeyRefSpec>(in, out, options);
+            return;
+        }
+    }
+    RecordReader<Record> in(input_file);
+    RecordWriter<Record> out(output_file);
+    runSort<Spec>(in, out, options);
+}
+
+// генерирует текстовый вход из count случайных чисел для замеров
+void generateInput(const char* name, size_t count) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(-1000000000, 1000000000);
+    TextWriter out(name);
+    for (size_t i = 0; i < count; ++i)
+        out.put(dist(gen));
+}
+
+void randomRecord(std::mt19937_64& gen, int64_t& r) {
+    r = static_cast<int64_t>(gen());
+}
+
+void randomRecord(std::mt19937_64& gen, KeyValue16& r) {
+    r.key = gen();
+    r.payload = gen();
+}
+
+// метки времени из узкого окна, чтобы были повторы
+void randomRecord(std::mt19937_64& gen, TimestampRow& r) {
+    r.timestamp = 1700000000000LL + static_cast<int64_t>(gen() % 1000000) - 500000;
+    r.rowId = gen();
+}
+
+void randomRecord(std::mt19937_64& gen, Row64& r) {
+    r.key = gen();
+    for (size_t i = 0; i < sizeof(r.payload); i += sizeof(uint64_t)) {
+        uint64_t v = gen();
+        memcpy(r.payload + i, &v, sizeof(v));
+    }
+}
+
+// сумма хешей записей не зависит от их порядка: по ней проверяется, что выход - перестановка входа
+uint64_t recordHash(const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+template <typename Record>
+uint64_t generateRecords(const char* name, size_t count) {
+    std::mt19937_64 gen(42);
+    RecordWriter<Record> out(name);
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Record r;
+        randomRecord(gen, r);
+        checksum += recordHash(&r, sizeof(r));
+        out.put(r);
+    }
+    return checksum;
+}
+
+template <typename Spec>
+bool verifyRecords(const char* name, size_t count, uint64_t checksum) {
+    using Record = typename Spec::RecordType;
+    RecordReader<Record> in(name);
+    Record prev, cur;
+    size_t n = 0;
+    uint64_t sum = 0;
+    while (in.next(cur)) {
+        if (n > 0 && Spec::recordLess(cur, prev)) return false;
+        sum += recordHash(&cur, sizeof(cur));
+        prev = cur;
+        ++n;
+    }
+    return n == count && sum == checksum;
+}
+
+// Замер на случайных записях: генерация, сортировка и проверка результата.
+template <typename Spec>
+int benchmarkRecords(size_t count, const SortOptions& options) {
+    using Record = typename Spec::RecordType;
+    std::string input = spill.path("bench_input.bin");
+    std::string output = spill.path("bench_output.bin");
+    const char* input_file = input.c_str();
+    const char* output_file = output.c_str();
+    uint64_t checksum = generateRecords<Record>(input_file, count);
+    bytesReadTotal = 0;
+    bytesWrittenTotal = 0;
+    sortRecordFile<Spec>(input_file, output_file, options);
+    printPhaseStats();
+    bool ok = verifyRecords<Spec>(output_file, count, checksum);
+    fprintf(stderr, "record %zu bytes, %s\n", sizeof(Record), ok ? "output verified" : "OUTPUT IS WRONG");
+    remove(input_file);
+    remove(output_file);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
     const char* input_file = "task3_input.txt";
     const char* output_file = "task3_output.txt";
-    externalQuickSort(input_file, output_file);
+    size_t bench_count = 0;
+    size_t bench_kernels = 0;
+    bool merge_mode = false;
+    size_t fan_in = 0;
+    size_t memory_budget = DEFAULT_MEMORY_BUDGET;
+    size_t threads = 1;
+    std::string record = "int32";
+    bool key_prefix = false;
+    std::vector<std::string> tmp_dirs;
+
+    // task3 [вход] [выход] [--mem=SIZE] [--threads=N] [--mode=quick|merge] [--fan-in=K]
+    //       [--io=sync|threads|uring] [--io-depth=N] [--kernel=auto|radix|intro|quick]
+    //       [--record=int32|int64|kv16|ts|row64] [--key-prefix] [--tmp-dir=DIR[,DIR...]]
+    //       [--bench=N] [--bench-kernels=N]
+    // int32 - текстовый вход и выход, остальные типы записей - бинарные файлы
+    // (kv16: uint64 ключ + uint64, ts: int64 метка времени + uint64, row64: uint64 ключ + 56 байт)
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--bench=", 8) == 0) {
+            bench_count = strtoull(argv[i] + 8, nullptr, 10);
+        } else if (strncmp(argv[i], "--bench-kernels=", 16) == 0) {
+            bench_kernels = strtoull(argv[i] + 16, nullptr, 10);
+        } else if (strcmp(argv[i], "--kernel=auto") == 0) {
+            sortKernel = SortKernel::Auto;
+        } else if (strcmp(argv[i], "--kernel=radix") == 0) {
+            sortKernel = SortKernel::Radix;
+        } else if (strcmp(argv[i], "--kernel=intro") == 0) {
+            sortKernel = SortKernel::Intro;
+        } else if (strcmp(argv[i], "--kernel=quick") == 0) {
+            sortKernel = SortKernel::Quick;
+        } else if (strcmp(argv[i], "--mode=merge") == 0) {
+            merge_mode = true;
+        } else if (strcmp(argv[i], "--mode=quick") == 0) {
+            merge_mode = false;
+        } else if (strncmp(argv[i], "--mem=", 6) == 0) {
+            memory_budget = parseSize(argv[i] + 6);
+            if (memory_budget == 0) {
+                fprintf(stderr, "Некорректный бюджет памяти: %s\n", argv[i] + 6);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            // 0 - по числу ядер
+            threads = strtoull(argv[i] + 10, nullptr, 10);
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        } else if (strcmp(argv[i], "--io=sync") == 0) {
+            ioBackend = IoBackend::Sync;
+        } else if (strcmp(argv[i], "--io=threads") == 0) {
+            ioBackend = IoBackend::Threads;
+        } else if (strcmp(argv[i], "--io=uring") == 0) {
+#ifdef USE_IO_URING
+            ioBackend = IoBackend::Uring;
+#else
+            fprintf(stderr, "Собрано без io_uring (-DUSE_IO_URING -luring), используется threads\n");
+            ioBackend = IoBackend::Threads;
+#endif
+        } else if (strncmp(argv[i], "--io-depth=", 11) == 0) {
+            // 2 - двойная буферизация, 3 - тройная
+            ioDepth = std::max<size_t>(1, strtoull(argv[i] + 11, nullptr, 10));
+        } else if (strncmp(argv[i], "--fan-in=", 9) == 0) {
+            fan_in = strtoull(argv[i] + 9, nullptr, 10);
+        } else if (strncmp(argv[i], "--record=", 9) == 0) {
+            record = argv[i] + 9;
+            if (record != "int32" && record != "int64" && record != "kv16" && record != "ts" &&
+                record != "row64") {
+                fprintf(stderr, "Неизвестный тип записи: %s\n", argv[i] + 9);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--key-prefix") == 0) {
+            key_prefix = true;
+        } else if (strncmp(argv[i], "--tmp-dir=", 10) == 0) {
+            // несколько каталогов через запятую или повтором параметра, файлы чередуются между ними
+            std::string dirs = argv[i] + 10;
+            for (size_t start = 0; start <= dirs.size();) {
+                size_t end = std::min(dirs.find(',', start), dirs.size());
+                if (end > start) tmp_dirs.push_back(dirs.substr(start, end - start));
+                start = end + 1;
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Неизвестный параметр: %s\n", argv[i]);
+            return 1;
+        } else if (positional == 0) {
+            input_file = argv[i];
+            ++positional;
+        } else {
+            output_file = argv[i];
+            ++positional;
+        }
+    }
+
+    mallopt(M_MMAP_THRESHOLD, MMAP_THRESHOLD);
+    sortConfig = makeSortConfig(memory_budget, threads);
+
+    if (bench_kernels > 0) {
+        benchmarkKernels(bench_kernels);
+        return 0;
+    }
+
+    if (tmp_dirs.empty()) tmp_dirs.push_back(".");
+    spill.open(tmp_dirs);
+
+    SortOptions options = {merge_mode, fan_in, key_prefix};
+    if (record != "int32") {
+        if (bench_count > 0) {
+            if (record == "int64") return benchmarkRecords<Int64Spec>(bench_count, options);
+            if (record == "kv16") return benchmarkRecords<KeyValueSpec>(bench_count, options);
+            if (record == "ts") return benchmarkRecords<TimestampSpec>(bench_count, options);
+            return benchmarkRecords<Row64Spec>(bench_count, options);
+        }
+        if (record == "int64") sortRecordFile<Int64Spec>(input_file, output_file, options);
+        else if (record == "kv16") sortRecordFile<KeyValueSpec>(input_file, output_file, options);
+        else if (record == "ts") sortRecordFile<TimestampSpec>(input_file, output_file, options);
+        else sortRecordFile<Row64Spec>(input_file, output_file, options);
+        printPhaseStats();
+        return 0;
+    }
+
+    std::string bench_input = spill.path("bench_input.txt");
+    std::string bench_output = spill.path("bench_output.txt");
+    if (bench_count > 0) {
+        input_file = bench_input.c_str();
+        output_file = bench_output.c_str();
+        generateInput(input_file, bench_count);
+    }
+
+    sortTextFile(input_file, output_file, options);
+    printPhaseStats();
+
+    if (bench_count > 0) {
+        remove(input_file);
+        remove(output_file);
+    }
     return 0;
 }
@@ -1,69 +1,2025 @@
 #include <vector>
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <set>
+#include <string>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATRIX_X86 1
+#endif
 
-void matrix_multiply_recursive(const std::vector<float>& matrix_a, const std::vector<float>& matrix_b, // K×N
-                               std::vector<float>& result_matrix,
-                               size_t current_m, size_t current_k, size_t current_n,
-                               size_t full_k, size_t full_n,
-                               std::pair<size_t, size_t> a_offset = {0, 0},
-                               std::pair<size_t, size_t> b_offset = {0, 0},
-                               std::pair<size_t, size_t> c_offset  = {0, 0})
+// Операнды перед умножением упаковываются в полосы (как в BLIS):
+//  - A режется на полосы по MR строк; внутри полосы для каждого p подряд лежат
+//    MR чисел столбца p, т.е. полоса - это K×MR, прочитанная по строкам;
+//  - B режется на полосы по NR столбцов; внутри полосы для каждого p подряд лежат
+//    NR чисел строки p.
+// Последняя полоса дополняется нулями. Микроядро в результате читает оба операнда
+// строго последовательно, а листовой блок любой глубины рекурсии - это несколько
+// непрерывных кусков полос, поэтому TLB и кэш работают на рекурсию, а не против нее.
+
+// Микроядро: C[MR×NR] += A[MR×k] * B[k×NR] по упакованным полосам, строки C идут с шагом ldc.
+// Плитка C все время лежит в регистрах; на шаге p строка полосы B загружается
+// векторами, а A[i][p] размножается на весь вектор, так что каждое умножение - одна FMA.
+// Ядра написаны для упакованного типа P и типа накопления A; ядро выбирается при
+// запуске по возможностям процессора.
+template <typename P, typename A>
+struct MicroKernel {
+    typedef void (*Run)(size_t k, const P* a, const P* b, A* c, size_t ldc);
+
+    const char* name;
+    size_t mr;
+    size_t nr;
+    // полосы группируют по kr соседних p (для целых - пары под madd), k кратно kr
+    size_t kr;
+    Run run;
+};
+
+// прежний базовый случай: скалярное произведение строки A на столбец B
+template <typename P, typename A>
+void micro_kernel_scalar(size_t k, const P* a, const P* b, A* c, size_t) {
+    A sum = 0;
+    for (size_t p = 0; p < k; ++p)
+        sum += static_cast<A>(a[p]) * static_cast<A>(b[p]);
+    c[0] += sum;
+}
+
+#ifdef MATRIX_X86
+// SSE есть на любом x86-64, но без FMA: умножение и сложение отдельно
+__attribute__((target("sse2")))
+void micro_kernel_sse(size_t k, const float* a, const float* b, float* c, size_t ldc) {
+    const size_t MR = 4;
+    const size_t NR = 8;
+    __m128 c0[MR], c1[MR];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm_loadu_ps(c + i * ldc);
+        c1[i] = _mm_loadu_ps(c + i * ldc + 4);
+    }
+    for (size_t p = 0; p < k; ++p) {
+        __m128 b0 = _mm_loadu_ps(b + p * NR);
+        __m128 b1 = _mm_loadu_ps(b + p * NR + 4);
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; ++i) {
+            __m128 ai = _mm_set1_ps(a[p * MR + i]);
+            c0[i] = _mm_add_ps(c0[i], _mm_mul_ps(ai, b0));
+            c1[i] = _mm_add_ps(c1[i], _mm_mul_ps(ai, b1));
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        _mm_storeu_ps(c + i * ldc, c0[i]);
+        _mm_storeu_ps(c + i * ldc + 4, c1[i]);
+    }
+}
+
+// 4×16: 8 накопителей покрывают задержку FMA при двух FMA за такт
+__attribute__((target("avx2,fma")))
+void micro_kernel_avx2(size_t k, const float* a, const float* b, float* c, size_t ldc) {
+    const size_t MR = 4;
+    const size_t NR = 16;
+    __m256 c0[MR], c1[MR];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm256_loadu_ps(c + i * ldc);
+        c1[i] = _mm256_loadu_ps(c + i * ldc + 8);
+    }
+    for (size_t p = 0; p < k; ++p) {
+        __m256 b0 = _mm256_loadu_ps(b + p * NR);
+        __m256 b1 = _mm256_loadu_ps(b + p * NR + 8);
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; ++i) {
+            __m256 ai = _mm256_broadcast_ss(a + p * MR + i);
+            c0[i] = _mm256_fmadd_ps(ai, b0, c0[i]);
+            c1[i] = _mm256_fmadd_ps(ai, b1, c1[i]);
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        _mm256_storeu_ps(c + i * ldc, c0[i]);
+        _mm256_storeu_ps(c + i * ldc + 8, c1[i]);
+    }
+}
+
+// 8×32: 16 накопителей из 32 регистров zmm
+__attribute__((target("avx512f")))
+void micro_kernel_avx512(size_t k, const float* a, const float* b, float* c, size_t ldc) {
+    const size_t MR = 8;
+    const size_t NR = 32;
+    __m512 c0[MR], c1[MR];
+#pragma GCC unroll 8
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm512_loadu_ps(c + i * ldc);
+        c1[i] = _mm512_loadu_ps(c + i * ldc + 16);
+    }
+    for (size_t p = 0; p < k; ++p) {
+        __m512 b0 = _mm512_loadu_ps(b + p * NR);
+        __m512 b1 = _mm512_loadu_ps(b + p * NR + 16);
+#pragma GCC unroll 8
+        for (size_t i = 0; i < MR; ++i) {
+            __m512 ai = _mm512_set1_ps(a[p * MR + i]);
+            c0[i] = _mm512_fmadd_ps(ai, b0, c0[i]);
+            c1[i] = _mm512_fmadd_ps(ai, b1, c1[i]);
+        }
+    }
+#pragma GCC unroll 8
+    for (size_t i = 0; i < MR; ++i) {
+        _mm512_storeu_ps(c + i * ldc, c0[i]);
+        _mm512_storeu_ps(c + i * ldc + 16, c1[i]);
+    }
+}
+
+// double: та же раскладка регистров, но в вектор помещается вдвое меньше чисел,
+// поэтому NR вдвое меньше, чем у float
+__attribute__((target("sse2")))
+void micro_kernel_sse(size_t k, const double* a, const double* b, double* c, size_t ldc) {
+    const size_t MR = 4;
+    const size_t NR = 4;
+    __m128d c0[MR], c1[MR];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm_loadu_pd(c + i * ldc);
+        c1[i] = _mm_loadu_pd(c + i * ldc + 2);
+    }
+    for (size_t p = 0; p < k; ++p) {
+        __m128d b0 = _mm_loadu_pd(b + p * NR);
+        __m128d b1 = _mm_loadu_pd(b + p * NR + 2);
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; ++i) {
+            __m128d ai = _mm_set1_pd(a[p * MR + i]);
+            c0[i] = _mm_add_pd(c0[i], _mm_mul_pd(ai, b0));
+            c1[i] = _mm_add_pd(c1[i], _mm_mul_pd(ai, b1));
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        _mm_storeu_pd(c + i * ldc, c0[i]);
+        _mm_storeu_pd(c + i * ldc + 2, c1[i]);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void micro_kernel_avx2(size_t k, const double* a, const double* b, double* c, size_t ldc) {
+    const size_t MR = 4;
+    const size_t NR = 8;
+    __m256d c0[MR], c1[MR];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm256_loadu_pd(c + i * ldc);
+        c1[i] = _mm256_loadu_pd(c + i * ldc + 4);
+    }
+    for (size_t p = 0; p < k; ++p) {
+        __m256d b0 = _mm256_loadu_pd(b + p * NR);
+        __m256d b1 = _mm256_loadu_pd(b + p * NR + 4);
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; ++i) {
+            __m256d ai = _mm256_broadcast_sd(a + p * MR + i);
+            c0[i] = _mm256_fmadd_pd(ai, b0, c0[i]);
+            c1[i] = _mm256_fmadd_pd(ai, b1, c1[i]);
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        _mm256_storeu_pd(c + i * ldc, c0[i]);
+        _mm256_storeu_pd(c + i * ldc + 4, c1[i]);
+    }
+}
+
+__attribute__((target("avx512f")))
+void micro_kernel_avx512(size_t k, const double* a, const double* b, double* c, size_t ldc) {
+    const size_t MR = 8;
+    const size_t NR = 16;
+    __m512d c0[MR], c1[MR];
+#pragma GCC unroll 8
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm512_loadu_pd(c + i * ldc);
+        c1[i] = _mm512_loadu_pd(c + i * ldc + 8);
+    }
+    for (size_t p = 0; p < k; ++p) {
+        __m512d b0 = _mm512_loadu_pd(b + p * NR);
+        __m512d b1 = _mm512_loadu_pd(b + p * NR + 8);
+#pragma GCC unroll 8
+        for (size_t i = 0; i < MR; ++i) {
+            __m512d ai = _mm512_set1_pd(a[p * MR + i]);
+            c0[i] = _mm512_fmadd_pd(ai, b0, c0[i]);
+            c1[i] = _mm512_fmadd_pd(ai, b1, c1[i]);
+        }
+    }
+#pragma GCC unroll 8
+    for (size_t i = 0; i < MR; ++i) {
+        _mm512_storeu_pd(c + i * ldc, c0[i]);
+        _mm512_storeu_pd(c + i * ldc + 8, c1[i]);
+    }
+}
+
+// Целые: int8 и int16 упаковываются в int16 парами по p (kr = 2), и одна инструкция
+// madd дает a[i][p] * b[p][j] + a[i][p+1] * b[p+1][j] сразу в int32. Пара A[i] берется
+// как одно 32-битное число и размножается на весь вектор.
+static inline int32_t load_pair(const int16_t* pair) {
+    int32_t value;
+    memcpy(&value, pair, sizeof(value));
+    return value;
+}
+
+__attribute__((target("sse2")))
+void micro_kernel_sse(size_t k, const int16_t* a, const int16_t* b, int32_t* c, size_t ldc) {
+    const size_t MR = 4;
+    const size_t NR = 8;
+    __m128i c0[MR], c1[MR];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i * ldc));
+        c1[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i * ldc + 4));
+    }
+    for (size_t p = 0; p < k; p += 2) {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + p * NR));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + p * NR + 8));
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; ++i) {
+            __m128i ai = _mm_set1_epi32(load_pair(a + p * MR + 2 * i));
+            c0[i] = _mm_add_epi32(c0[i], _mm_madd_epi16(ai, b0));
+            c1[i] = _mm_add_epi32(c1[i], _mm_madd_epi16(ai, b1));
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c + i * ldc), c0[i]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c + i * ldc + 4), c1[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+void micro_kernel_avx2(size_t k, const int16_t* a, const int16_t* b, int32_t* c, size_t ldc) {
+    const size_t MR = 4;
+    const size_t NR = 16;
+    __m256i c0[MR], c1[MR];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i * ldc));
+        c1[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i * ldc + 8));
+    }
+    for (size_t p = 0; p < k; p += 2) {
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + p * NR));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + p * NR + 16));
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; ++i) {
+            __m256i ai = _mm256_set1_epi32(load_pair(a + p * MR + 2 * i));
+            c0[i] = _mm256_add_epi32(c0[i], _mm256_madd_epi16(ai, b0));
+            c1[i] = _mm256_add_epi32(c1[i], _mm256_madd_epi16(ai, b1));
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; ++i) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + i * ldc), c0[i]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + i * ldc + 8), c1[i]);
+    }
+}
+
+// madd для zmm есть только в AVX-512BW
+__attribute__((target("avx512f,avx512bw")))
+void micro_kernel_avx512(size_t k, const int16_t* a, const int16_t* b, int32_t* c, size_t ldc) {
+    const size_t MR = 8;
+    const size_t NR = 32;
+    __m512i c0[MR], c1[MR];
+#pragma GCC unroll 8
+    for (size_t i = 0; i < MR; ++i) {
+        c0[i] = _mm512_loadu_si512(c + i * ldc);
+        c1[i] = _mm512_loadu_si512(c + i * ldc + 16);
+    }
+    for (size_t p = 0; p < k; p += 2) {
+        __m512i b0 = _mm512_loadu_si512(b + p * NR);
+        __m512i b1 = _mm512_loadu_si512(b + p * NR + 32);
+#pragma GCC unroll 8
+        for (size_t i = 0; i < MR; ++i) {
+            __m512i ai = _mm512_set1_epi32(load_pair(a + p * MR + 2 * i));
+            c0[i] = _mm512_add_epi32(c0[i], _mm512_madd_epi16(ai, b0));
+            c1[i] = _mm512_add_epi32(c1[i], _mm512_madd_epi16(ai, b1));
+        }
+    }
+#pragma GCC unroll 8
+    for (size_t i = 0; i < MR; ++i) {
+        _mm512_storeu_si512(c + i * ldc, c0[i]);
+        _mm512_storeu_si512(c + i * ldc + 16, c1[i]);
+    }
+}
+#endif
+
+// ядра, которые может выполнить этот процессор, от простого к быстрому
+template <typename P, typename A>
+std::vector<MicroKernel<P, A>> available_micro_kernels();
+
+template <>
+std::vector<MicroKernel<float, float>> available_micro_kernels<float, float>() {
+    std::vector<MicroKernel<float, float>> kernels = {{"scalar", 1, 1, 1, micro_kernel_scalar<float, float>}};
+#ifdef MATRIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back({"sse", 4, 8, 1, micro_kernel_sse});
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernels.push_back({"avx2", 4, 16, 1, micro_kernel_avx2});
+    if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back({"avx512", 8, 32, 1, micro_kernel_avx512});
+#endif
+    return kernels;
+}
+
+template <>
+std::vector<MicroKernel<double, double>> available_micro_kernels<double, double>() {
+    std::vector<MicroKernel<double, double>> kernels = {{"scalar", 1, 1, 1, micro_kernel_scalar<double, double>}};
+#ifdef MATRIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back({"sse", 4, 4, 1, micro_kernel_sse});
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernels.push_back({"avx2", 4, 8, 1, micro_kernel_avx2});
+    if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back({"avx512", 8, 16, 1, micro_kernel_avx512});
+#endif
+    return kernels;
+}
+
+template <>
+std::vector<MicroKernel<int16_t, int32_t>> available_micro_kernels<int16_t, int32_t>() {
+    std::vector<MicroKernel<int16_t, int32_t>> kernels = {{"scalar", 1, 1, 1, micro_kernel_scalar<int16_t, int32_t>}};
+#ifdef MATRIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back({"sse", 4, 8, 2, micro_kernel_sse});
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back({"avx2", 4, 16, 2, micro_kernel_avx2});
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        kernels.push_back({"avx512", 8, 32, 2, micro_kernel_avx512});
+#endif
+    return kernels;
+}
+
+// выбранное ядро для каждой пары типов; --kernel= меняет все сразу
+template <typename P, typename A>
+MicroKernel<P, A> micro_kernel = available_micro_kernels<P, A>().back();
+
+template <typename P, typename A>
+bool select_micro_kernel(const char* name) {
+    for (const auto& kernel : available_micro_kernels<P, A>()) {
+        if (strcmp(kernel.name, name) == 0) {
+            micro_kernel<P, A> = kernel;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Тип входных чисел In и тип накопления (и результата) Acc определяют, в каком
+// виде хранятся упакованные полосы и какими ядрами они умножаются. Преобразование
+// делается при упаковке, она стоит O(n^2), так что ядра видят уже готовый тип:
+//  - float с накоплением в double пакуется сразу в double;
+//  - int8 и int16 пакуются в int16 для madd с накоплением в int32.
+// Остальные сочетания не определены и не компилируются.
+template <typename In, typename Acc>
+struct GemmTraits;
+
+template <>
+struct GemmTraits<float, float> {
+    typedef float Packed;
+};
+
+template <>
+struct GemmTraits<double, double> {
+    typedef double Packed;
+};
+
+template <>
+struct GemmTraits<float, double> {
+    typedef double Packed;
+};
+
+template <>
+struct GemmTraits<int16_t, int32_t> {
+    typedef int16_t Packed;
+};
+
+template <>
+struct GemmTraits<int8_t, int32_t> {
+    typedef int16_t Packed;
+};
+
+// Рекурсия останавливается, когда M и N блока не больше leaf_mn, а K - не больше leaf_k.
+// Какой размер делить, пока блок не стал листом, решает SplitOrder:
+//  - split_largest: больший относительно своего предела листа (прежнее правило);
+//  - split_mn_first: сначала M и N, K - только в конце, блок C один на весь K;
+//  - split_k_first: сначала K, чтобы блок B k×n переиспользовался по всем строкам.
+// Значения по умолчанию - прежний лист 64×64×64; --autotune подбирает их под машину.
+enum SplitOrder { split_largest, split_mn_first, split_k_first };
+const char* const split_order_names[] = {"largest", "mn-first", "k-first"};
+
+struct GemmTuning {
+    size_t leaf_mn;
+    size_t leaf_k;
+    SplitOrder split;
+};
+
+GemmTuning gemm_tuning = {64, 64, split_largest};
+
+enum SplitDim { split_m, split_k, split_n };
+
+bool is_leaf(const GemmTuning& tuning, size_t m, size_t k, size_t n) {
+    return m <= tuning.leaf_mn && k <= tuning.leaf_k && n <= tuning.leaf_mn;
+}
+
+// вызывать только для блока, который еще не лист
+SplitDim choose_split(const GemmTuning& tuning, size_t m, size_t k, size_t n) {
+    if (tuning.split == split_mn_first && (m > tuning.leaf_mn || n > tuning.leaf_mn))
+        return m >= n ? split_m : split_n;
+    if (tuning.split == split_k_first && k <= tuning.leaf_k)
+        return m >= n ? split_m : split_n;
+    if (tuning.split != split_largest)
+        return split_k;
+    // сравнение m / leaf_mn, k / leaf_k и n / leaf_mn без деления
+    if (m * tuning.leaf_k >= std::max(k * tuning.leaf_mn, n * tuning.leaf_k))
+        return split_m;
+    return k * tuning.leaf_mn >= n * tuning.leaf_k ? split_k : split_n;
+}
+
+// Лист не меньше полосы ядра: M и N режутся по границам MR и NR, а K - кратно kr,
+// так что меньший лист недостижим и рекурсия по такому размеру не продвигалась бы
+template <typename P, typename A>
+GemmTuning tuning_for(const GemmTuning& tuning, const MicroKernel<P, A>& kernel) {
+    return {std::max({tuning.leaf_mn, kernel.mr, kernel.nr}), std::max(tuning.leaf_k, kernel.kr), tuning.split};
+}
+
+const size_t max_mr = 8;
+const size_t max_nr = 32;
+const size_t cache_line = 64;
+
+// Выровненная по строке кэша память под упакованные операнды. Выделяется один раз
+// и переиспользуется следующими умножениями; растет, только если не хватило места.
+class AlignedArena {
+public:
+    AlignedArena() : data(nullptr), capacity(0), used(0) {}
+
+    ~AlignedArena() {
+        std::free(data);
+    }
+
+    // освобождает все выделенное и гарантирует bytes байт
+    void reset(size_t bytes) {
+        used = 0;
+        bytes = round_up(bytes);
+        if (bytes <= capacity) return;
+        std::free(data);
+        data = static_cast<char*>(std::aligned_alloc(cache_line, bytes));
+        if (!data) throw std::bad_alloc();
+        capacity = bytes;
+    }
+
+    template <typename T>
+    T* allocate(size_t count) {
+        size_t bytes = round_up(count * sizeof(T));
+        if (used + bytes > capacity) throw std::bad_alloc();
+        T* result = reinterpret_cast<T*>(data + used);
+        used += bytes;
+        return result;
+    }
+
+    // стековое использование: запомнить занятое место и потом вернуться к нему
+    size_t mark() const {
+        return used;
+    }
+
+    void release(size_t mark) {
+        used = mark;
+    }
+
+    // место под массив из count чисел типа T с учетом выравнивания
+    template <typename T>
+    static size_t footprint(size_t count) {
+        return round_up(count * sizeof(T));
+    }
+
+    AlignedArena(const AlignedArena&) = delete;
+    AlignedArena& operator=(const AlignedArena&) = delete;
+
+private:
+    static size_t round_up(size_t bytes) {
+        return (bytes + cache_line - 1) / cache_line * cache_line;
+    }
+
+    char* data;
+    size_t capacity;
+    size_t used;
+};
+
+thread_local AlignedArena pack_arena;
+
+size_t round_up(size_t value, size_t step) {
+    return (value + step - 1) / step * step;
+}
+
+// Известная структура операнда. Треугольные считаются нулевыми по другую сторону
+// диагонали (что там лежит в памяти, не важно), у симметричных действителен только
+// указанный треугольник, а второй берется зеркально при упаковке.
+enum MatrixStructure { general, lower_triangular, upper_triangular, symmetric_lower, symmetric_upper };
+
+// Структура op(X): при транспонировании нижний треугольник становится верхним.
+MatrixStructure transposed_structure(MatrixStructure structure) {
+    switch (structure) {
+    case lower_triangular: return upper_triangular;
+    case upper_triangular: return lower_triangular;
+    case symmetric_lower: return symmetric_upper;
+    case symmetric_upper: return symmetric_lower;
+    default: return structure;
+    }
+}
+
+// элемент (row, col) матрицы со структурой structure, лежащей как x[row * rs + col * cs]
+template <typename In>
+In structured_element(const In* x, size_t rs, size_t cs, MatrixStructure structure, size_t row, size_t col) {
+    switch (structure) {
+    case lower_triangular:
+        if (col > row) return In(0);
+        break;
+    case upper_triangular:
+        if (col < row) return In(0);
+        break;
+    case symmetric_lower:
+        if (col > row) std::swap(row, col);
+        break;
+    case symmetric_upper:
+        if (col < row) std::swap(row, col);
+        break;
+    default:
+        break;
+    }
+    return x[row * rs + col * cs];
+}
+
+// Полосы по mr строк из A (m×k); элемент (i, p) лежит в a[i * rs + p * cs], так что
+// транспонированная матрица - это просто другие шаги. dst - round_up(m, mr)×round_up(k, kr)
+// чисел. Внутри полосы группа из kr соседних p лежит как mr×kr, так что при kr = 1
+// это прежняя раскладка "для каждого p подряд MR чисел столбца". Каждое число
+// умножается на scale (alpha из gemm), чтобы не масштабировать потом C.
+// structure - структура самой A (m×k, квадратной, если не general).
+template <typename In, typename P, typename S>
+void pack_a(const In* a, size_t rs, size_t cs, MatrixStructure structure, size_t m, size_t k, size_t mr, size_t kr,
+            S scale, P* dst) {
+    const size_t kp = round_up(k, kr);
+    for (size_t i0 = 0; i0 < m; i0 += mr) {
+        P* panel = dst + i0 * kp;
+        for (size_t r = 0; r < mr; ++r) {
+            const size_t i = i0 + r;
+            for (size_t p = 0; p < kp; p += kr)
+                for (size_t s = 0; s < kr; ++s)
+                    panel[p * mr + r * kr + s] =
+                        i < m && p + s < k
+                            ? static_cast<P>(scale * static_cast<S>(structured_element(a, rs, cs, structure, i, p + s)))
+                            : P(0);
+        }
+    }
+}
+
+// полосы по nr столбцов из B (k×n, элемент (p, j) в b[p * rs + j * cs]);
+// dst - round_up(k, kr)×round_up(n, nr) чисел
+template <typename In, typename P>
+void pack_b(const In* b, size_t rs, size_t cs, MatrixStructure structure, size_t k, size_t n, size_t nr, size_t kr,
+            P* dst) {
+    const size_t kp = round_up(k, kr);
+    for (size_t j0 = 0; j0 < n; j0 += nr) {
+        P* panel = dst + j0 * kp;
+        size_t width = std::min(nr, n - j0);
+        for (size_t p = 0; p < kp; p += kr) {
+            P* out = panel + p * nr;
+            for (size_t s = 0; s < kr; ++s) {
+                for (size_t j = 0; j < width; ++j)
+                    out[j * kr + s] =
+                        p + s < k ? static_cast<P>(structured_element(b, rs, cs, structure, p + s, j0 + j)) : P(0);
+                for (size_t j = width; j < nr; ++j) out[j * kr + s] = P(0);
+            }
+        }
+    }
+}
+
+// Упакованные операнды одного умножения. Полоса A с номером i / MR начинается
+// с a + i * k, полоса B с номером j / NR - с b + j * k; сдвиг на p внутри полосы -
+// p * MR и p * NR соответственно. k здесь уже округлено вверх до kr ядра.
+template <typename P, typename A>
+struct PackedOperands {
+    const P* a;
+    const P* b;
+    A* c;
+    size_t m;
+    size_t k;
+    size_t n;
+    size_t ldc;
+    MicroKernel<P, A> kernel;
+    GemmTuning tuning;
+    // структуры op(A) и op(B): блоки, целиком лежащие в нулевом треугольнике, пропускаются
+    MatrixStructure a_structure;
+    MatrixStructure b_structure;
+};
+
+// Блок op(A)[i0, i0 + m)×[p0, p0 + k) или op(B)[p0, p0 + k)×[j0, j0 + n) весь в нулевом
+// треугольнике - тогда его вклад в C нулевой и считать его не нужно.
+template <typename P, typename A>
+bool is_zero_block(const PackedOperands<P, A>& op, size_t i0, size_t p0, size_t j0, size_t m, size_t k, size_t n) {
+    if (op.a_structure == lower_triangular && p0 >= i0 + m) return true;
+    if (op.a_structure == upper_triangular && p0 + k <= i0) return true;
+    if (op.b_structure == lower_triangular && j0 >= p0 + k) return true;
+    if (op.b_structure == upper_triangular && j0 + n <= p0) return true;
+    return false;
+}
+
+// Листовой блок: строки [i0, i0 + m), общий размер [p0, p0 + k), столбцы [j0, j0 + n).
+// i0 и j0 кратны MR и NR, p0 - kr. Плитки, выходящие за край C, считаются во временный буфер.
+template <typename P, typename A>
+void multiply_leaf(const PackedOperands<P, A>& op, size_t i0, size_t p0, size_t j0, size_t m, size_t k, size_t n) {
+    const size_t mr = op.kernel.mr;
+    const size_t nr = op.kernel.nr;
+    for (size_t i = i0; i < i0 + m; i += mr) {
+        const P* a_panel = op.a + i * op.k + p0 * mr;
+        for (size_t j = j0; j < j0 + n; j += nr) {
+            const P* b_panel = op.b + j * op.k + p0 * nr;
+            A* c = op.c + i * op.ldc + j;
+            if (i + mr <= op.m && j + nr <= op.n) {
+                op.kernel.run(k, a_panel, b_panel, c, op.ldc);
+                continue;
+            }
+            size_t rows = std::min(mr, op.m - i);
+            size_t cols = std::min(nr, op.n - j);
+            A c_pad[max_mr * max_nr] = {};
+            for (size_t r = 0; r < rows; ++r)
+                for (size_t s = 0; s < cols; ++s)
+                    c_pad[r * nr + s] = c[r * op.ldc + s];
+            op.kernel.run(k, a_panel, b_panel, c_pad, nr);
+            for (size_t r = 0; r < rows; ++r)
+                for (size_t s = 0; s < cols; ++s)
+                    c[r * op.ldc + s] = c_pad[r * nr + s];
+        }
+    }
+}
+
+// Делит пополам размер, выбранный choose_split. Разрез по M и N проходит по границе
+// полосы (кратно MR и NR), а по K - кратно kr, чтобы листья начинались с начала группы.
+template <typename P, typename A>
+void matrix_multiply_recursive(const PackedOperands<P, A>& op, size_t i0, size_t p0, size_t j0,
+                               size_t current_m, size_t current_k, size_t current_n)
 {
+    if (is_zero_block(op, i0, p0, j0, current_m, current_k, current_n)) return;
+
     // Базовый случай для маленьких блоков
-    const size_t block_size = 32;
-    if (current_m <= block_size && current_k <= block_size && current_n <= block_size) {
-        for (size_t i = 0; i < current_m; ++i) {
-            for (size_t j = 0; j < current_n; ++j) {
-                float sum = 0.0f;
-                for (size_t k = 0; k < current_k; ++k) {
-                    sum += matrix_a[(a_offset.first + i) * full_k + (a_offset.second + k)] *
-                           matrix_b[(b_offset.first + k) * full_n + (b_offset.second + j)];
+    if (is_leaf(op.tuning, current_m, current_k, current_n)) {
+        multiply_leaf(op, i0, p0, j0, current_m, current_k, current_n);
+        return;
+    }
+
+    // рекурсия
+    SplitDim dim = choose_split(op.tuning, current_m, current_k, current_n);
+    if (dim == split_m) {
+        size_t half = round_up(current_m / 2, op.kernel.mr);
+        matrix_multiply_recursive(op, i0, p0, j0, half, current_k, current_n);
+        matrix_multiply_recursive(op, i0 + half, p0, j0, current_m - half, current_k, current_n);
+    } else if (dim == split_k) {
+        size_t half = round_up(current_k / 2, op.kernel.kr);
+        matrix_multiply_recursive(op, i0, p0, j0, current_m, half, current_n);
+        matrix_multiply_recursive(op, i0, p0 + half, j0, current_m, current_k - half, current_n);
+    } else {
+        size_t half = round_up(current_n / 2, op.kernel.nr);
+        matrix_multiply_recursive(op, i0, p0, j0, current_m, current_k, half);
+        matrix_multiply_recursive(op, i0, p0, j0 + half, current_m, current_k, current_n - half);
+    }
+}
+
+// Пул с перехватом задач для рекурсии fork-join. У каждого потока своя очередь:
+// владелец кладет и забирает задачи с конца (последняя порожденная задача - самая
+// "горячая" в кэше), а простаивающий поток крадет с начала чужой очереди - там лежат
+// самые крупные, ранние подзадачи. Ожидающий завершения группы поток не спит, а
+// выполняет задачи сам, поэтому вложенные ожидания не блокируют пул.
+class WorkStealingPool {
+public:
+    struct TaskGroup {
+        std::atomic<size_t> pending{0};
+    };
+
+    explicit WorkStealingPool(size_t threads) : queues(std::max<size_t>(threads, 1)), queued(0), stop(false) {
+        for (size_t w = 1; w < queues.size(); ++w)
+            workers.emplace_back([this, w] { worker_loop(w); });
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    size_t size() const {
+        return queues.size();
+    }
+
+    // выполняет root в вызывающем потоке, который на это время становится рабочим 0
+    void run(const std::function<void()>& root) {
+        std::lock_guard<std::mutex> lock(run_mutex);
+        current_index = 0;
+        root();
+    }
+
+    void spawn(TaskGroup& group, std::function<void()> fn) {
+        ++group.pending;
+        Queue& queue = queues[current_index];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back({std::move(fn), &group});
+        }
+        ++queued;
+        { std::lock_guard<std::mutex> lock(wake_mutex); }
+        wake.notify_one();
+    }
+
+    void wait(TaskGroup& group) {
+        while (group.pending > 0) {
+            Task task;
+            if (take(current_index, task))
+                execute(task);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool take(size_t self, Task& task) {
+        for (size_t i = 0; i < queues.size(); ++i) {
+            Queue& queue = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            --queued;
+            return true;
+        }
+        return false;
+    }
+
+    static void execute(Task& task) {
+        task.fn();
+        --task.group->pending;
+    }
+
+    void worker_loop(size_t index) {
+        current_index = index;
+        while (true) {
+            Task task;
+            if (take(index, task)) {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait(lock, [&] { return stop || queued > 0; });
+            if (stop) return;
+        }
+    }
+
+    static thread_local size_t current_index;
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool stop;
+    std::mutex run_mutex;
+};
+
+thread_local size_t WorkStealingPool::current_index = 0;
+
+// Блоки меньше parallel_grain умножений-сложений считаются одной задачей: порождение
+// задачи стоит порядка микросекунд, а такой блок - сотни микросекунд.
+size_t parallel_grain = size_t(1) << 21;
+
+// Параллельная версия рекурсии. Половины по M и по N пишут в разные блоки C и
+// выполняются как независимые задачи; половины по K пишут в один и тот же блок C,
+// поэтому выполняются друг за другом (каждая по-прежнему параллельна внутри).
+// Здесь всегда делится наибольший из размеров, еще не дошедших до предела листа, -
+// так задач больше; порядок из GemmTuning действует ниже, в последовательной рекурсии.
+template <typename P, typename A>
+void matrix_multiply_parallel(WorkStealingPool& pool, const PackedOperands<P, A>& op, size_t i0, size_t p0, size_t j0,
+                              size_t current_m, size_t current_k, size_t current_n) {
+    if (is_zero_block(op, i0, p0, j0, current_m, current_k, current_n)) return;
+    if (current_m * current_k * current_n <= parallel_grain || is_leaf(op.tuning, current_m, current_k, current_n)) {
+        matrix_multiply_recursive(op, i0, p0, j0, current_m, current_k, current_n);
+        return;
+    }
+
+    // размер, уже не больше предела листа, считается нулевым: делить его бесполезно
+    const size_t m_size = current_m > op.tuning.leaf_mn ? current_m : 0;
+    const size_t k_size = current_k > op.tuning.leaf_k ? current_k : 0;
+    const size_t n_size = current_n > op.tuning.leaf_mn ? current_n : 0;
+    WorkStealingPool::TaskGroup group;
+    if (m_size >= std::max(k_size, n_size)) {
+        size_t half = round_up(current_m / 2, op.kernel.mr);
+        pool.spawn(group, [&pool, &op, i0, p0, j0, half, current_k, current_n] {
+            matrix_multiply_parallel(pool, op, i0, p0, j0, half, current_k, current_n);
+        });
+        matrix_multiply_parallel(pool, op, i0 + half, p0, j0, current_m - half, current_k, current_n);
+    } else if (k_size >= n_size) {
+        size_t half = round_up(current_k / 2, op.kernel.kr);
+        matrix_multiply_parallel(pool, op, i0, p0, j0, current_m, half, current_n);
+        matrix_multiply_parallel(pool, op, i0, p0 + half, j0, current_m, current_k - half, current_n);
+    } else {
+        size_t half = round_up(current_n / 2, op.kernel.nr);
+        pool.spawn(group, [&pool, &op, i0, p0, j0, current_m, current_k, half] {
+            matrix_multiply_parallel(pool, op, i0, p0, j0, current_m, current_k, half);
+        });
+        matrix_multiply_parallel(pool, op, i0, p0, j0 + half, current_m, current_k, current_n - half);
+    }
+    pool.wait(group);
+}
+
+// Пул живет между вызовами и пересоздается, только если изменилось число потоков.
+std::mutex gemm_pool_mutex;
+std::unique_ptr<WorkStealingPool> gemm_pool;
+
+// hardware_concurrency читает системные файлы и стоит микросекунды - больше, чем
+// маленькое умножение целиком, поэтому спрашиваем один раз
+size_t default_threads() {
+    static const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    return threads;
+}
+
+// вызывать под gemm_pool_mutex
+WorkStealingPool& shared_pool(size_t threads) {
+    if (!gemm_pool || gemm_pool->size() != threads)
+        gemm_pool.reset(new WorkStealingPool(threads));
+    return *gemm_pool;
+}
+
+// op(X) в gemm: X как есть или X^T
+enum Transpose { no_transpose, transpose };
+
+// Невладеющий вид на матрицу rows×cols, лежащую по строкам с шагом ld >= cols.
+// Подматрица большей матрицы - тот же вид со сдвинутым data и прежним ld.
+// structure помечает квадратную треугольную или симметричную матрицу (для операндов A и B).
+template <typename T>
+struct MatrixView {
+    typedef T value_type;
+
+    MatrixView(T* data, size_t rows, size_t cols)
+        : data(data), rows(rows), cols(cols), ld(cols), structure(general) {}
+    MatrixView(T* data, size_t rows, size_t cols, size_t ld, MatrixStructure structure = general)
+        : data(data), rows(rows), cols(cols), ld(ld), structure(structure) {}
+
+    // вид только для чтения из изменяемого
+    template <typename U>
+    MatrixView(const MatrixView<U>& other)
+        : data(other.data), rows(other.rows), cols(other.cols), ld(other.ld), structure(other.structure) {}
+
+    T* data;
+    size_t rows;
+    size_t cols;
+    size_t ld;
+    MatrixStructure structure;
+};
+
+// размеры op(X)
+template <typename T>
+size_t op_rows(const MatrixView<T>& x, Transpose trans) {
+    return trans == no_transpose ? x.rows : x.cols;
+}
+
+template <typename T>
+size_t op_cols(const MatrixView<T>& x, Transpose trans) {
+    return trans == no_transpose ? x.cols : x.rows;
+}
+
+template <typename T>
+MatrixStructure op_structure(const MatrixView<T>& x, Transpose trans) {
+    return trans == no_transpose ? x.structure : transposed_structure(x.structure);
+}
+
+template <typename T>
+void check_view(const MatrixView<T>& x) {
+    if (x.ld < x.cols) {
+        throw std::invalid_argument("Leading dimension is smaller than the number of columns");
+    }
+    if (x.structure != general && x.rows != x.cols) {
+        throw std::invalid_argument("Triangular or symmetric matrix must be square");
+    }
+}
+
+// op(A) - a_rows×a_cols, op(B) - b_rows×b_cols
+template <typename Acc>
+void check_product_shape(size_t a_rows, size_t a_cols, size_t b_rows, size_t b_cols, const MatrixView<Acc>& c) {
+    check_view(c);
+    if (a_cols != b_rows || c.rows != a_rows || c.cols != b_cols) {
+        throw std::invalid_argument("Matrix dimensions don't match");
+    }
+}
+
+template <typename In, typename Acc>
+void check_gemm_dimensions(Transpose trans_a, const MatrixView<const In>& a, Transpose trans_b,
+                           const MatrixView<const In>& b, const MatrixView<Acc>& c) {
+    check_view(a);
+    check_view(b);
+    check_product_shape(op_rows(a, trans_a), op_cols(a, trans_a), op_rows(b, trans_b), op_cols(b, trans_b), c);
+}
+
+// C = beta * C; при beta = 0 прежнее содержимое C не читается (как в BLAS, NaN в C не выживает)
+template <typename Acc>
+void scale_matrix(const MatrixView<Acc>& c, Acc beta) {
+    if (beta == Acc(1)) return;
+    for (size_t i = 0; i < c.rows; ++i) {
+        Acc* row = c.data + i * c.ld;
+        for (size_t j = 0; j < c.cols; ++j)
+            row[j] = beta == Acc(0) ? Acc(0) : beta * row[j];
+    }
+}
+
+template <typename In, typename Acc>
+void gemm_run(Transpose trans_a, Transpose trans_b, Acc alpha, const MatrixView<const In>& a,
+              const MatrixView<const In>& b, Acc beta, const MatrixView<Acc>& c, WorkStealingPool* pool);
+
+// Strassen-Winograd: 7 умножений половинного размера вместо 8 и 15 сложений.
+// Включается только для float и double (у целых суммы не помещаются в int16 полос,
+// а накопление float в double нужно ради точности, которую Strassen как раз теряет)
+// и только пока все размеры не меньше strassen_crossover; ниже - обычная рекурсия.
+// 0 - выключено.
+size_t strassen_crossover = 0;
+
+template <typename T>
+MatrixView<T> sub_view(const MatrixView<T>& x, size_t row, size_t col, size_t rows, size_t cols) {
+    return MatrixView<T>(x.data + row * x.ld + col, rows, cols, x.ld);
+}
+
+// op(X) вместе с флагом: блоки и элементы берутся уже с учетом транспонирования
+template <typename T>
+struct OpView {
+    MatrixView<const T> view;
+    Transpose trans;
+
+    T at(size_t i, size_t j) const {
+        return trans == no_transpose ? view.data[i * view.ld + j] : view.data[j * view.ld + i];
+    }
+
+    OpView block(size_t row, size_t col, size_t rows, size_t cols) const {
+        if (trans == no_transpose) return {sub_view(view, row, col, rows, cols), trans};
+        return {sub_view(view, col, row, cols, rows), trans};
+    }
+};
+
+template <typename T>
+OpView<T> as_op(const MatrixView<T>& x) {
+    return {x, no_transpose};
+}
+
+// out = x + sign * y; out может совпадать с x или y
+template <typename T>
+void combine(const MatrixView<T>& out, const OpView<T>& x, const OpView<T>& y, T sign) {
+    if (x.trans == no_transpose && y.trans == no_transpose) {
+        // обычный случай - построчно, без ветвлений, чтобы цикл векторизовался
+        for (size_t i = 0; i < out.rows; ++i) {
+            T* row = out.data + i * out.ld;
+            const T* x_row = x.view.data + i * x.view.ld;
+            const T* y_row = y.view.data + i * y.view.ld;
+            for (size_t j = 0; j < out.cols; ++j)
+                row[j] = x_row[j] + sign * y_row[j];
+        }
+        return;
+    }
+    for (size_t i = 0; i < out.rows; ++i) {
+        T* row = out.data + i * out.ld;
+        for (size_t j = 0; j < out.cols; ++j)
+            row[j] = x.at(i, j) + sign * y.at(i, j);
+    }
+}
+
+bool use_strassen(size_t m, size_t k, size_t n) {
+    return strassen_crossover > 0 && std::min({m, k, n}) >= std::max<size_t>(strassen_crossover, 2);
+}
+
+// Байты рабочей памяти для strassen_multiply: на каждом уровне два временных блока,
+// уровни идут один за другим, так что нужна сумма по глубине.
+template <typename T>
+size_t strassen_workspace(size_t m, size_t k, size_t n) {
+    if (!use_strassen(m, k, n)) return 0;
+    size_t m2 = m / 2, k2 = k / 2, n2 = n / 2;
+    return AlignedArena::footprint<T>(m2 * std::max(k2, n2)) + AlignedArena::footprint<T>(k2 * n2) +
+           strassen_workspace<T>(m2, k2, n2);
+}
+
+thread_local AlignedArena strassen_arena;
+
+// C = op(A) * op(B) (C перезаписывается). Четная часть считается по схеме Винограда
+// с двумя временными блоками X и Y (порядок шагов из Boyer, Dumas, Pernet, Zhou,
+// "Memory efficient scheduling of Strassen-Winograd's matrix multiplication algorithm"),
+// нечетные строка, столбец и слой по K отщепляются и досчитываются обычным gemm_run.
+template <typename T>
+void strassen_multiply(const OpView<T>& a, const OpView<T>& b, const MatrixView<T>& c, WorkStealingPool* pool) {
+    const size_t m = c.rows;
+    const size_t k = op_cols(a.view, a.trans);
+    const size_t n = c.cols;
+    if (!use_strassen(m, k, n)) {
+        gemm_run(a.trans, b.trans, T(1), a.view, b.view, T(0), c, pool);
+        return;
+    }
+
+    const size_t m2 = m / 2, k2 = k / 2, n2 = n / 2;
+    OpView<T> a11 = a.block(0, 0, m2, k2), a12 = a.block(0, k2, m2, k2);
+    OpView<T> a21 = a.block(m2, 0, m2, k2), a22 = a.block(m2, k2, m2, k2);
+    OpView<T> b11 = b.block(0, 0, k2, n2), b12 = b.block(0, n2, k2, n2);
+    OpView<T> b21 = b.block(k2, 0, k2, n2), b22 = b.block(k2, n2, k2, n2);
+    MatrixView<T> c11 = sub_view(c, 0, 0, m2, n2), c12 = sub_view(c, 0, n2, m2, n2);
+    MatrixView<T> c21 = sub_view(c, m2, 0, m2, n2), c22 = sub_view(c, m2, n2, m2, n2);
+
+    size_t mark = strassen_arena.mark();
+    T* x_data = strassen_arena.allocate<T>(m2 * std::max(k2, n2));
+    T* y_data = strassen_arena.allocate<T>(k2 * n2);
+    MatrixView<T> xs(x_data, m2, k2);  // X под суммы A
+    MatrixView<T> xp(x_data, m2, n2);  // X под P1
+    MatrixView<T> y(y_data, k2, n2);
+
+    combine(xs, a11, a21, T(-1));                          // S3 = A11 - A21
+    combine(y, b22, b12, T(-1));                           // T3 = B22 - B12
+    strassen_multiply(as_op(xs), as_op(y), c21, pool);     // P7 = S3 * T3
+    combine(xs, a21, a22, T(1));                           // S1 = A21 + A22
+    combine(y, b12, b11, T(-1));                           // T1 = B12 - B11
+    strassen_multiply(as_op(xs), as_op(y), c22, pool);     // P5 = S1 * T1
+    combine(xs, as_op(xs), a11, T(-1));                    // S2 = S1 - A11
+    combine(y, b22, as_op(y), T(-1));                      // T2 = B22 - T1
+    strassen_multiply(as_op(xs), as_op(y), c12, pool);     // P6 = S2 * T2
+    combine(xs, a12, as_op(xs), T(-1));                    // S4 = A12 - S2
+    strassen_multiply(as_op(xs), b22, c11, pool);          // P3 = S4 * B22
+    strassen_multiply(a11, b11, xp, pool);                 // P1 = A11 * B11
+    combine(c12, as_op(xp), as_op(c12), T(1));             // U2 = P1 + P6
+    combine(c21, as_op(c12), as_op(c21), T(1));            // U3 = U2 + P7
+    combine(c12, as_op(c12), as_op(c22), T(1));            // U4 = U2 + P5
+    combine(c22, as_op(c21), as_op(c22), T(1));            // U7 = U3 + P5 = C22
+    combine(c12, as_op(c12), as_op(c11), T(1));            // U5 = U4 + P3 = C12
+    combine(y, as_op(y), b21, T(-1));                      // T4 = T2 - B21
+    strassen_multiply(a22, as_op(y), c11, pool);           // P4 = A22 * T4
+    combine(c21, as_op(c21), as_op(c11), T(-1));           // U6 = U3 - P4 = C21
+    strassen_multiply(a12, b21, c11, pool);                // P2 = A12 * B21
+    combine(c11, as_op(xp), as_op(c11), T(1));             // U1 = P1 + P2 = C11
+    strassen_arena.release(mark);
+
+    // нечетные размеры: слой по K добавляется к четной части, строка и столбец считаются целиком
+    if (k % 2) {
+        OpView<T> a_col = a.block(0, 2 * k2, 2 * m2, 1);
+        OpView<T> b_row = b.block(2 * k2, 0, 1, 2 * n2);
+        gemm_run(a_col.trans, b_row.trans, T(1), a_col.view, b_row.view, T(1), sub_view(c, 0, 0, 2 * m2, 2 * n2),
+                 pool);
+    }
+    if (n % 2) {
+        OpView<T> a_top = a.block(0, 0, 2 * m2, k);
+        OpView<T> b_col = b.block(0, 2 * n2, k, 1);
+        gemm_run(a_top.trans, b_col.trans, T(1), a_top.view, b_col.view, T(0), sub_view(c, 0, 2 * n2, 2 * m2, 1),
+                 pool);
+    }
+    if (m % 2) {
+        OpView<T> a_row = a.block(2 * m2, 0, 1, k);
+        gemm_run(a_row.trans, b.trans, T(1), a_row.view, b.view, T(0), sub_view(c, 2 * m2, 0, 1, n), pool);
+    }
+}
+
+// C = alpha * op(A) * op(B) + C (beta уже применено). Вся рабочая память берется из
+// strassen_arena одним куском до начала счета.
+template <typename T>
+void strassen_gemm(Transpose trans_a, Transpose trans_b, T alpha, const MatrixView<const T>& a,
+                   const MatrixView<const T>& b, bool overwrite, const MatrixView<T>& c, WorkStealingPool* pool) {
+    const size_t m = c.rows;
+    const size_t n = c.cols;
+    const size_t k = op_cols(a, trans_a);
+    const bool direct = overwrite && alpha == T(1);
+    strassen_arena.reset(strassen_workspace<T>(m, k, n) + (direct ? 0 : AlignedArena::footprint<T>(m * n)));
+    if (direct) {
+        strassen_multiply(OpView<T>{a, trans_a}, OpView<T>{b, trans_b}, c, pool);
+        return;
+    }
+    // иначе произведение считается отдельно и прибавляется к C с множителем
+    MatrixView<T> product(strassen_arena.allocate<T>(m * n), m, n);
+    strassen_multiply(OpView<T>{a, trans_a}, OpView<T>{b, trans_b}, product, pool);
+    for (size_t i = 0; i < m; ++i)
+        for (size_t j = 0; j < n; ++j)
+            c.data[i * c.ld + j] += alpha * product.data[i * n + j];
+}
+
+// Разреженная матрица rows×cols в CSR: ненулевые строки i - это columns[idx] и values[idx]
+// для idx из [row_start[i], row_start[i + 1]).
+template <typename T>
+struct CsrMatrix {
+    size_t rows;
+    size_t cols;
+    std::vector<size_t> row_start;
+    std::vector<size_t> columns;
+    std::vector<T> values;
+};
+
+// CSR из op(X) с учетом структуры X
+template <typename T>
+CsrMatrix<T> to_csr(const MatrixView<const T>& x, Transpose trans) {
+    const size_t rs = trans == no_transpose ? x.ld : 1;
+    const size_t cs = trans == no_transpose ? 1 : x.ld;
+    const MatrixStructure structure = op_structure(x, trans);
+    CsrMatrix<T> csr = {op_rows(x, trans), op_cols(x, trans), {0}, {}, {}};
+    csr.row_start.reserve(csr.rows + 1);
+    for (size_t i = 0; i < csr.rows; ++i) {
+        for (size_t j = 0; j < csr.cols; ++j) {
+            T value = structured_element(x.data, rs, cs, structure, i, j);
+            if (value == T(0)) continue;
+            csr.columns.push_back(j);
+            csr.values.push_back(value);
+        }
+        csr.row_start.push_back(csr.columns.size());
+    }
+    return csr;
+}
+
+// транспонирование CSR подсчетом: сначала число элементов в каждом столбце, потом раскладка
+template <typename T>
+CsrMatrix<T> transpose_csr(const CsrMatrix<T>& x) {
+    CsrMatrix<T> result = {x.cols, x.rows, std::vector<size_t>(x.cols + 1, 0), std::vector<size_t>(x.values.size()),
+                           std::vector<T>(x.values.size())};
+    for (size_t column : x.columns) ++result.row_start[column + 1];
+    for (size_t j = 0; j < x.cols; ++j) result.row_start[j + 1] += result.row_start[j];
+    std::vector<size_t> next(result.row_start.begin(), result.row_start.end() - 1);
+    for (size_t i = 0; i < x.rows; ++i) {
+        for (size_t idx = x.row_start[i]; idx < x.row_start[i + 1]; ++idx) {
+            size_t position = next[x.columns[idx]]++;
+            result.columns[position] = i;
+            result.values[position] = x.values[idx];
+        }
+    }
+    return result;
+}
+
+// op(X) со структурой в плотном виде по строкам - для разреженных ядер, которым
+// нужен непрерывный доступ к строкам плотного операнда
+template <typename T>
+std::vector<T> dense_copy(const MatrixView<const T>& x, Transpose trans) {
+    const size_t rs = trans == no_transpose ? x.ld : 1;
+    const size_t cs = trans == no_transpose ? 1 : x.ld;
+    const MatrixStructure structure = op_structure(x, trans);
+    const size_t rows = op_rows(x, trans);
+    const size_t cols = op_cols(x, trans);
+    std::vector<T> result(rows * cols);
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            result[i * cols + j] = structured_element(x.data, rs, cs, structure, i, j);
+    return result;
+}
+
+// Ненулевых в X не больше density от всех. Счет обрывается, как только предел
+// превышен, поэтому на плотной матрице проверка читает лишь ее начало.
+template <typename T>
+bool sparser_than(const MatrixView<const T>& x, double density) {
+    const size_t limit = static_cast<size_t>(density * x.rows * x.cols);
+    size_t nonzeros = 0;
+    for (size_t i = 0; i < x.rows; ++i) {
+        const T* row = x.data + i * x.ld;
+        for (size_t j = 0; j < x.cols; ++j)
+            if (row[j] != T(0) && ++nonzeros > limit) return false;
+    }
+    return true;
+}
+
+// Автоматический выбор в gemm: если доля ненулевых в A или B не больше sparse_threshold,
+// операнд переводится в CSR и умножается разреженным ядром (0 - не проверять).
+// Проверяются только общие (не треугольные и не симметричные) операнды и только
+// когда все размеры не меньше sparse_min_size - на мелких проверка дороже выигрыша.
+// По --bench-sparse CSR обгоняет плотное ядро при 2-5% ненулевых, порог - посередине.
+double sparse_threshold = 0.03;
+const size_t sparse_min_size = 64;
+
+// C += alpha * A * B, A в CSR, B плотная по строкам. Рекурсия та же, что у плотного
+// умножения: блок C делится по большему из M и N до листа leaf_mn×leaf_mn, так что
+// полоса строк B шириной лист остается в кэше, пока по ней проходят все строки блока.
+// Половины пишут в разные блоки C и с пулом выполняются параллельно.
+template <typename In, typename Acc>
+struct CsrDenseOperands {
+    const CsrMatrix<In>* a;
+    const In* b;
+    size_t ldb;
+    Acc* c;
+    size_t ldc;
+    Acc alpha;
+    GemmTuning tuning;
+};
+
+template <typename In, typename Acc>
+void csr_dense_multiply(const CsrDenseOperands<In, Acc>& op, WorkStealingPool* pool, size_t i0, size_t j0, size_t m,
+                        size_t n) {
+    const CsrMatrix<In>& a = *op.a;
+    const size_t nonzeros = a.row_start[i0 + m] - a.row_start[i0];
+    if (nonzeros == 0) return;
+
+    if (m <= op.tuning.leaf_mn && n <= op.tuning.leaf_mn) {
+        for (size_t i = i0; i < i0 + m; ++i) {
+            Acc* c_row = op.c + i * op.ldc + j0;
+            for (size_t idx = a.row_start[i]; idx < a.row_start[i + 1]; ++idx) {
+                const Acc value = op.alpha * static_cast<Acc>(a.values[idx]);
+                const In* b_row = op.b + a.columns[idx] * op.ldb + j0;
+                // по 8 с известным числом повторений: это векторизуется и при -O2;
+                // строка C и строка B не пересекаются
+                size_t j = 0;
+                for (; j + 8 <= n; j += 8) {
+#pragma GCC ivdep
+                    for (size_t t = 0; t < 8; ++t) c_row[j + t] += value * static_cast<Acc>(b_row[j + t]);
                 }
-                result_matrix[(c_offset.first + i) * full_n + (c_offset.second + j)] += sum;
+                for (; j < n; ++j) c_row[j] += value * static_cast<Acc>(b_row[j]);
+            }
+        }
+        return;
+    }
+
+    const bool split_rows = m >= n;
+    const size_t half = split_rows ? m / 2 : n / 2;
+    auto first = [&op, pool, i0, j0, m, n, half, split_rows] {
+        if (split_rows) csr_dense_multiply(op, pool, i0, j0, half, n);
+        else csr_dense_multiply(op, pool, i0, j0, m, half);
+    };
+    if (pool && nonzeros * n > parallel_grain) {
+        WorkStealingPool::TaskGroup group;
+        pool->spawn(group, first);
+        if (split_rows) csr_dense_multiply(op, pool, i0 + half, j0, m - half, n);
+        else csr_dense_multiply(op, pool, i0, j0 + half, m, n - half);
+        pool->wait(group);
+    } else {
+        first();
+        if (split_rows) csr_dense_multiply(op, pool, i0 + half, j0, m - half, n);
+        else csr_dense_multiply(op, pool, i0, j0 + half, m, n - half);
+    }
+}
+
+// C += alpha * A * B, A плотная по строкам, B в CSR. Для каждой строки A ненулевое
+// A[i][p] разносится по ненулевым строки p матрицы B. Блок делится по M (половины
+// независимы) и по K (половины пишут в те же строки C, поэтому идут друг за другом);
+// в листе leaf_mn×leaf_k строки B из диапазона K переиспользуются всеми строками блока.
+template <typename In, typename Acc>
+struct DenseCsrOperands {
+    const In* a;
+    size_t lda;
+    const CsrMatrix<In>* b;
+    Acc* c;
+    size_t ldc;
+    Acc alpha;
+    GemmTuning tuning;
+};
+
+template <typename In, typename Acc>
+void dense_csr_multiply(const DenseCsrOperands<In, Acc>& op, WorkStealingPool* pool, size_t i0, size_t p0, size_t m,
+                        size_t k) {
+    const CsrMatrix<In>& b = *op.b;
+    const size_t nonzeros = b.row_start[p0 + k] - b.row_start[p0];
+    if (nonzeros == 0) return;
+
+    if (m <= op.tuning.leaf_mn && k <= op.tuning.leaf_k) {
+        for (size_t i = i0; i < i0 + m; ++i) {
+            const In* a_row = op.a + i * op.lda;
+            Acc* c_row = op.c + i * op.ldc;
+            for (size_t p = p0; p < p0 + k; ++p) {
+                if (a_row[p] == In(0)) continue;
+                const Acc value = op.alpha * static_cast<Acc>(a_row[p]);
+                for (size_t idx = b.row_start[p]; idx < b.row_start[p + 1]; ++idx)
+                    c_row[b.columns[idx]] += value * static_cast<Acc>(b.values[idx]);
             }
         }
         return;
     }
 
-    // рекурсия
-    if (current_m >= std::max(current_k, current_n)) {
-        size_t half = current_m / 2;
-        matrix_multiply_recursive(matrix_a, matrix_b, result_matrix, half, current_k, current_n,
-                                  full_k, full_n, a_offset, b_offset, c_offset);
-        matrix_multiply_recursive(matrix_a, matrix_b, result_matrix, current_m - half, current_k, current_n,
-                                  full_k, full_n, {a_offset.first + half, a_offset.second}, b_offset,
-                                  {c_offset.first + half, c_offset.second});
-    } else if (current_k >= current_n) {
-        size_t half = current_k / 2;
-        matrix_multiply_recursive(matrix_a, matrix_b, result_matrix, current_m, half, current_n,
-                                  full_k, full_n, a_offset, b_offset, c_offset);
-        matrix_multiply_recursive(matrix_a, matrix_b, result_matrix, current_m, current_k - half, current_n,
-                                  full_k, full_n, {a_offset.first, a_offset.second + half},
-                                  {b_offset.first + half, b_offset.second}, c_offset);
-    } else {
-        size_t half = current_n / 2;
-        matrix_multiply_recursive(matrix_a, matrix_b, result_matrix, current_m, current_k, half,
-                                  full_k, full_n, a_offset, b_offset, c_offset);
-        matrix_multiply_recursive(matrix_a, matrix_b, result_matrix, current_m, current_k, current_n - half,
-                                  full_k, full_n, a_offset, {b_offset.first, b_offset.second + half},
-                                  {c_offset.first, c_offset.second + half});
+    if (m * op.tuning.leaf_k < k * op.tuning.leaf_mn) {
+        const size_t half = k / 2;
+        dense_csr_multiply(op, pool, i0, p0, m, half);
+        dense_csr_multiply(op, pool, i0, p0 + half, m, k - half);
+        return;
+    }
+    const size_t half = m / 2;
+    if (pool && nonzeros * m > parallel_grain) {
+        WorkStealingPool::TaskGroup group;
+        pool->spawn(group, [&op, pool, i0, p0, half, k] { dense_csr_multiply(op, pool, i0, p0, half, k); });
+        dense_csr_multiply(op, pool, i0 + half, p0, m - half, k);
+        pool->wait(group);
+    } else {
+        dense_csr_multiply(op, pool, i0, p0, half, k);
+        dense_csr_multiply(op, pool, i0 + half, p0, m - half, k);
+    }
+}
+
+// C += alpha * A * op(B) и C += alpha * op(A) * B для уже проверенных размеров; плотный
+// операнд с транспонированием или структурой сначала разворачивается в обычный.
+template <typename In, typename Acc>
+void csr_dense_accumulate(Acc alpha, const CsrMatrix<In>& a, Transpose trans_b, const MatrixView<const In>& b,
+                          const MatrixView<Acc>& c, WorkStealingPool* pool) {
+    if (c.rows == 0 || c.cols == 0 || alpha == Acc(0)) return;
+    std::vector<In> copy;
+    const In* dense = b.data;
+    size_t ldb = b.ld;
+    if (trans_b == transpose || b.structure != general) {
+        copy = dense_copy(b, trans_b);
+        dense = copy.data();
+        ldb = c.cols;
+    }
+    CsrDenseOperands<In, Acc> op = {&a, dense, ldb, c.data, c.ld, alpha, gemm_tuning};
+    csr_dense_multiply(op, pool, 0, 0, c.rows, c.cols);
+}
+
+template <typename In, typename Acc>
+void dense_csr_accumulate(Acc alpha, Transpose trans_a, const MatrixView<const In>& a, const CsrMatrix<In>& b,
+                          const MatrixView<Acc>& c, WorkStealingPool* pool) {
+    if (c.rows == 0 || c.cols == 0 || b.rows == 0 || alpha == Acc(0)) return;
+    std::vector<In> copy;
+    const In* dense = a.data;
+    size_t lda = a.ld;
+    if (trans_a == transpose || a.structure != general) {
+        copy = dense_copy(a, trans_a);
+        dense = copy.data();
+        lda = b.rows;
+    }
+    DenseCsrOperands<In, Acc> op = {dense, lda, &b, c.data, c.ld, alpha, gemm_tuning};
+    dense_csr_multiply(op, pool, 0, 0, c.rows, b.rows);
+}
+
+// C = alpha * op(A) * op(B) + beta * C для уже проверенных размеров. Без пула считает
+// в вызывающем потоке, с пулом - параллельно (вызывать внутри pool.run). Упакованные
+// операнды лежат в арене вызывающего потока.
+template <typename In, typename Acc>
+void gemm_run(Transpose trans_a, Transpose trans_b, Acc alpha, const MatrixView<const In>& a,
+              const MatrixView<const In>& b, Acc beta, const MatrixView<Acc>& c, WorkStealingPool* pool) {
+    typedef typename GemmTraits<In, Acc>::Packed Packed;
+    const size_t M = c.rows;
+    const size_t K = op_cols(a, trans_a);
+    const size_t N = c.cols;
+    scale_matrix(c, beta);
+    if (M == 0 || K == 0 || N == 0 || alpha == Acc(0)) return;
+
+    const MatrixStructure a_structure = op_structure(a, trans_a);
+    const MatrixStructure b_structure = op_structure(b, trans_b);
+    if (sparse_threshold > 0 && a_structure == general && b_structure == general &&
+        std::min({M, K, N}) >= sparse_min_size) {
+        if (sparser_than(a, sparse_threshold)) {
+            csr_dense_accumulate(alpha, to_csr(a, trans_a), trans_b, b, c, pool);
+            return;
+        }
+        if (sparser_than(b, sparse_threshold)) {
+            dense_csr_accumulate(alpha, trans_a, a, to_csr(b, trans_b), c, pool);
+            return;
+        }
+    }
+
+    if constexpr (std::is_same<In, Acc>::value && std::is_floating_point<Acc>::value) {
+        if (a_structure == general && b_structure == general && use_strassen(M, K, N)) {
+            strassen_gemm(trans_a, trans_b, alpha, a, b, beta == Acc(0), c, pool);
+            return;
+        }
+    }
+
+    // Для целых alpha в упакованный int16 не помещается: считаем alpha = 1 во временную
+    // матрицу и прибавляем ее к C с множителем.
+    if (!std::is_floating_point<Packed>::value && alpha != Acc(1)) {
+        std::vector<Acc> product(M * N);
+        MatrixView<Acc> view(product.data(), M, N);
+        gemm_run(trans_a, trans_b, Acc(1), a, b, Acc(0), view, pool);
+        for (size_t i = 0; i < M; ++i)
+            for (size_t j = 0; j < N; ++j)
+                c.data[i * c.ld + j] += alpha * product[i * N + j];
+        return;
+    }
+
+    const MicroKernel<Packed, Acc> kernel = micro_kernel<Packed, Acc>;
+    const size_t padded_k = round_up(K, kernel.kr);
+    const size_t a_count = round_up(M, kernel.mr) * padded_k;
+    const size_t b_count = padded_k * round_up(N, kernel.nr);
+    pack_arena.reset(AlignedArena::footprint<Packed>(a_count) + AlignedArena::footprint<Packed>(b_count));
+    Packed* packed_a = pack_arena.allocate<Packed>(a_count);
+    Packed* packed_b = pack_arena.allocate<Packed>(b_count);
+    if (trans_a == no_transpose) pack_a(a.data, a.ld, 1, a_structure, M, K, kernel.mr, kernel.kr, alpha, packed_a);
+    else pack_a(a.data, 1, a.ld, a_structure, M, K, kernel.mr, kernel.kr, alpha, packed_a);
+    if (trans_b == no_transpose) pack_b(b.data, b.ld, 1, b_structure, K, N, kernel.nr, kernel.kr, packed_b);
+    else pack_b(b.data, 1, b.ld, b_structure, K, N, kernel.nr, kernel.kr, packed_b);
+
+    PackedOperands<Packed, Acc> op = {packed_a, packed_b, c.data, M, padded_k, N, c.ld, kernel,
+                                      tuning_for(gemm_tuning, kernel), a_structure, b_structure};
+    if (pool) matrix_multiply_parallel(*pool, op, 0, 0, 0, M, padded_k, N);
+    else matrix_multiply_recursive(op, 0, 0, 0, M, padded_k, N);
+}
+
+// job(pool) в вызывающем потоке, если поток один или работы (умножений-сложений)
+// не больше parallel_grain, иначе - в общем пуле
+template <typename Job>
+void run_gemm_job(size_t threads, size_t work, const Job& job) {
+    if (threads == 0) threads = default_threads();
+    if (threads == 1 || work <= parallel_grain) {
+        job(nullptr);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(gemm_pool_mutex);
+    WorkStealingPool& pool = shared_pool(threads);
+    pool.run([&] { job(&pool); });
+}
+
+// C = alpha * op(A) * op(B) + beta * C, где op(A) - M×K, op(B) - K×N, C - M×N.
+// A и B одного типа In (const или нет), тип C задает тип накопления, как в matrix_multiply.
+// threads = 0 - по числу ядер; блоки меньше parallel_grain считаются без пула.
+template <typename TA, typename TB, typename Acc>
+void gemm(Transpose trans_a, Transpose trans_b, typename MatrixView<Acc>::value_type alpha,
+          const MatrixView<TA>& a, const MatrixView<TB>& b, typename MatrixView<Acc>::value_type beta,
+          const MatrixView<Acc>& c, size_t threads = 0) {
+    typedef typename std::remove_const<TA>::type In;
+    static_assert(std::is_same<In, typename std::remove_const<TB>::type>::value,
+                  "A and B must have the same element type");
+    MatrixView<const In> view_a = a;
+    MatrixView<const In> view_b = b;
+    check_gemm_dimensions(trans_a, view_a, trans_b, view_b, c);
+    run_gemm_job(threads, c.rows * c.cols * op_cols(view_a, trans_a), [&](WorkStealingPool* pool) {
+        gemm_run(trans_a, trans_b, alpha, view_a, view_b, beta, c, pool);
+    });
+}
+
+// C = alpha * op(A) * op(B) + beta * C с A в CSR. Транспонированная A один раз
+// перекладывается в CSR транспонированной.
+template <typename In, typename TB, typename Acc>
+void gemm(Transpose trans_a, Transpose trans_b, typename MatrixView<Acc>::value_type alpha, const CsrMatrix<In>& a,
+          const MatrixView<TB>& b, typename MatrixView<Acc>::value_type beta, const MatrixView<Acc>& c,
+          size_t threads = 0) {
+    static_assert(std::is_same<In, typename std::remove_const<TB>::type>::value,
+                  "A and B must have the same element type");
+    MatrixView<const In> view_b = b;
+    check_view(view_b);
+    const size_t a_rows = trans_a == no_transpose ? a.rows : a.cols;
+    const size_t a_cols = trans_a == no_transpose ? a.cols : a.rows;
+    check_product_shape(a_rows, a_cols, op_rows(view_b, trans_b), op_cols(view_b, trans_b), c);
+    CsrMatrix<In> transposed;
+    if (trans_a == transpose) transposed = transpose_csr(a);
+    const CsrMatrix<In>& csr = trans_a == transpose ? transposed : a;
+    run_gemm_job(threads, csr.values.size() * c.cols, [&](WorkStealingPool* pool) {
+        scale_matrix(c, beta);
+        csr_dense_accumulate(alpha, csr, trans_b, view_b, c, pool);
+    });
+}
+
+// C = alpha * op(A) * op(B) + beta * C с B в CSR
+template <typename TA, typename In, typename Acc>
+void gemm(Transpose trans_a, Transpose trans_b, typename MatrixView<Acc>::value_type alpha, const MatrixView<TA>& a,
+          const CsrMatrix<In>& b, typename MatrixView<Acc>::value_type beta, const MatrixView<Acc>& c,
+          size_t threads = 0) {
+    static_assert(std::is_same<In, typename std::remove_const<TA>::type>::value,
+                  "A and B must have the same element type");
+    MatrixView<const In> view_a = a;
+    check_view(view_a);
+    const size_t b_rows = trans_b == no_transpose ? b.rows : b.cols;
+    const size_t b_cols = trans_b == no_transpose ? b.cols : b.rows;
+    check_product_shape(op_rows(view_a, trans_a), op_cols(view_a, trans_a), b_rows, b_cols, c);
+    CsrMatrix<In> transposed;
+    if (trans_b == transpose) transposed = transpose_csr(b);
+    const CsrMatrix<In>& csr = trans_b == transpose ? transposed : b;
+    run_gemm_job(threads, csr.values.size() * c.rows, [&](WorkStealingPool* pool) {
+        scale_matrix(c, beta);
+        dense_csr_accumulate(alpha, trans_a, view_a, csr, c, pool);
+    });
+}
+
+// один элемент пакета: c = alpha * op(a) * op(b) + beta * c
+template <typename In, typename Acc>
+struct GemmBatchEntry {
+    MatrixView<const In> a;
+    MatrixView<const In> b;
+    MatrixView<Acc> c;
+};
+
+template <typename In, typename Acc>
+struct GemmBatch {
+    Transpose trans_a;
+    Transpose trans_b;
+    Acc alpha;
+    Acc beta;
+    const GemmBatchEntry<In, Acc>* entries;
+};
+
+template <typename In, typename Acc>
+size_t batch_entry_flops(const GemmBatch<In, Acc>& batch, size_t index) {
+    const GemmBatchEntry<In, Acc>& entry = batch.entries[index];
+    return entry.c.rows * entry.c.cols * op_cols(entry.a, batch.trans_a);
+}
+
+// Делит список мелких умножений пополам, пока в куске больше parallel_grain операций;
+// каждый кусок - одна задача, умножения в ней идут подряд в одном потоке.
+template <typename In, typename Acc>
+void gemm_batch_range(WorkStealingPool& pool, const GemmBatch<In, Acc>& batch, const size_t* indices, size_t count) {
+    size_t flops = 0;
+    for (size_t i = 0; i < count && flops <= parallel_grain; ++i)
+        flops += batch_entry_flops(batch, indices[i]);
+    if (count == 1 || flops <= parallel_grain) {
+        for (size_t i = 0; i < count; ++i) {
+            const GemmBatchEntry<In, Acc>& entry = batch.entries[indices[i]];
+            gemm_run(batch.trans_a, batch.trans_b, batch.alpha, entry.a, entry.b, batch.beta, entry.c, nullptr);
+        }
+        return;
+    }
+
+    WorkStealingPool::TaskGroup group;
+    size_t half = count / 2;
+    pool.spawn(group, [&pool, &batch, indices, half] { gemm_batch_range(pool, batch, indices, half); });
+    gemm_batch_range(pool, batch, indices + half, count - half);
+    pool.wait(group);
+}
+
+// Пакет независимых умножений с общими флагами, alpha и beta. Ради него и сделан:
+// тысячи маленьких умножений за один вызов платят за пул, проверки и выбор ядра один раз,
+// а сами умножения раскладываются по потокам целиком, без разбиения каждого.
+// Крупные элементы (больше parallel_grain) считаются по одному, каждый всем пулом.
+// Размеры проверяются до начала счета: при ошибке ни одна C не меняется.
+template <typename In, typename Acc>
+void gemm_batched(Transpose trans_a, Transpose trans_b, typename MatrixView<Acc>::value_type alpha,
+                  const GemmBatchEntry<In, Acc>* entries, size_t count,
+                  typename MatrixView<Acc>::value_type beta, size_t threads = 0) {
+    for (size_t i = 0; i < count; ++i)
+        check_gemm_dimensions(trans_a, entries[i].a, trans_b, entries[i].b, entries[i].c);
+
+    GemmBatch<In, Acc> batch = {trans_a, trans_b, alpha, beta, entries};
+    if (threads == 0) threads = default_threads();
+    if (threads == 1) {
+        for (size_t i = 0; i < count; ++i)
+            gemm_run(trans_a, trans_b, alpha, entries[i].a, entries[i].b, beta, entries[i].c, nullptr);
+        return;
     }
+
+    std::vector<size_t> small;
+    small.reserve(count);
+    std::lock_guard<std::mutex> lock(gemm_pool_mutex);
+    WorkStealingPool& pool = shared_pool(threads);
+    pool.run([&] {
+        // Крупные - до мелких: пока идет крупное умножение, его полосы лежат в арене
+        // этого потока, и ожидающий поток не должен брать задачи, которые ее перепишут.
+        for (size_t i = 0; i < count; ++i) {
+            if (batch_entry_flops(batch, i) > parallel_grain)
+                gemm_run(trans_a, trans_b, batch.alpha, entries[i].a, entries[i].b, batch.beta, entries[i].c, &pool);
+            else
+                small.push_back(i);
+        }
+        if (!small.empty()) gemm_batch_range(pool, batch, small.data(), small.size());
+    });
 }
 
-void matrix_multiply(const std::vector<float>& matrix_a,
-                     const std::vector<float>& matrix_b,
-                     std::vector<float>& result_matrix,
-                      size_t M, size_t K, size_t N) {
+// прежний интерфейс: плотные матрицы по строкам, C = A * B
+template <typename In, typename Acc>
+void matrix_multiply(const std::vector<In>& matrix_a,
+                     const std::vector<In>& matrix_b,
+                     std::vector<Acc>& result_matrix,
+                      size_t M, size_t K, size_t N, size_t threads = 0) {
     if (matrix_a.size() != M * K || matrix_b.size() != K * N || result_matrix.size() != M * N) {
         throw std::invalid_argument("Matrix dimensions don't match");
     }
+    gemm(no_transpose, no_transpose, Acc(1), MatrixView<const In>(matrix_a.data(), M, K),
+         MatrixView<const In>(matrix_b.data(), K, N), Acc(0), MatrixView<Acc>(result_matrix.data(), M, N), threads);
+}
+
+// Случайные входы для замеров. Целые берутся небольшими, чтобы сумма по k = 4096
+// заведомо помещалась в int32.
+template <typename T>
+void fill_random(std::vector<T>& values, std::mt19937& gen) {
+    if (std::is_floating_point<T>::value) {
+        std::uniform_real_distribution<double> dist(-1.0, 1.0);
+        for (auto& v : values) v = static_cast<T>(dist(gen));
+    } else {
+        std::uniform_int_distribution<int> dist(-100, 100);
+        for (auto& v : values) v = static_cast<T>(dist(gen));
+    }
+}
+
+// типы элементов для --type=: имя, затем тип входа и тип накопления
+//   f32 - float, f64 - double, f32f64 - float с накоплением в double,
+//   i8, i16 - int8 и int16 с накоплением в int32
+const char* const element_types[] = {"f32", "f64", "f32f64", "i8", "i16"};
+const char* const kernel_names[] = {"scalar", "sse", "avx2", "avx512"};
+
+// Замер на квадратных матрицах n×n: для каждого типа элементов - GFLOP/s (для целых -
+// GOP/s) каждого доступного ядра (2n^3 операций) и расхождение с результатом первого
+// посчитанного ядра. Скалярное ядро на больших размерах работает минутами, поэтому
+// выше scalar_limit пропускается.
+template <typename In, typename Acc>
+void benchmark_type(const char* type, const std::vector<size_t>& sizes, size_t threads) {
+    typedef typename GemmTraits<In, Acc>::Packed Packed;
+    const size_t scalar_limit = 2048;
+    std::vector<MicroKernel<Packed, Acc>> kernels = available_micro_kernels<Packed, Acc>();
+    MicroKernel<Packed, Acc> selected = micro_kernel<Packed, Acc>;
+
+    std::mt19937 gen(42);
+    for (size_t n : sizes) {
+        std::vector<In> a(n * n), b(n * n);
+        std::vector<Acc> c(n * n), reference;
+        fill_random(a, gen);
+        fill_random(b, gen);
+        double max_diff = 0;
+        printf("%7s %6zu", type, n);
+        for (const char* name : kernel_names) {
+            auto kernel = std::find_if(kernels.begin(), kernels.end(),
+                                       [&](const MicroKernel<Packed, Acc>& k) { return strcmp(k.name, name) == 0; });
+            if (kernel == kernels.end() || (kernel->mr == 1 && n > scalar_limit)) {
+                printf(" %10s", "-");
+                continue;
+            }
+            micro_kernel<Packed, Acc> = *kernel;
+            auto start = std::chrono::steady_clock::now();
+            matrix_multiply(a, b, c, n, n, n, threads);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            printf(" %10.2f", 2.0 * n * n * n / elapsed.count() / 1e9);
+            fflush(stdout);
+            if (reference.empty()) {
+                reference = c;
+            } else {
+                for (size_t i = 0; i < c.size(); ++i)
+                    max_diff = std::max(max_diff, std::fabs(static_cast<double>(c[i]) - reference[i]));
+            }
+        }
+        printf(" %12.2e\n", max_diff);
+    }
+    micro_kernel<Packed, Acc> = selected;
+}
+
+// type - одно из element_types или пустая строка (все типы)
+void benchmark(const std::vector<size_t>& sizes, const std::string& type, size_t threads) {
+    printf("%7s %6s", "type", "n");
+    for (const char* name : kernel_names) printf(" %10s", name);
+    printf(" %12s\n", "max diff");
+    if (type.empty() || type == "f32") benchmark_type<float, float>("f32", sizes, threads);
+    if (type.empty() || type == "f64") benchmark_type<double, double>("f64", sizes, threads);
+    if (type.empty() || type == "f32f64") benchmark_type<float, double>("f32f64", sizes, threads);
+    if (type.empty() || type == "i8") benchmark_type<int8_t, int32_t>("i8", sizes, threads);
+    if (type.empty() || type == "i16") benchmark_type<int16_t, int32_t>("i16", sizes, threads);
+}
+
+// Сильная масштабируемость: одна и та же задача n×n на 1, 2, 4, ... потоках вплоть до
+// числа ядер. Ускорение и эффективность считаются относительно одного потока.
+void benchmark_scaling(const std::vector<size_t>& sizes) {
+    std::vector<size_t> thread_counts;
+    for (size_t t = 1; t < default_threads(); t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(default_threads());
+
+    printf("%6s %8s %10s %10s %10s\n", "n", "threads", "GFLOP/s", "speedup", "efficiency");
+    std::mt19937 gen(42);
+    for (size_t n : sizes) {
+        std::vector<float> a(n * n), b(n * n), c(n * n);
+        fill_random(a, gen);
+        fill_random(b, gen);
+        double base = 0;
+        for (size_t threads : thread_counts) {
+            auto start = std::chrono::steady_clock::now();
+            matrix_multiply(a, b, c, n, n, n, threads);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (threads == 1) base = elapsed.count();
+            printf("%6zu %8zu %10.2f %10.2f %9.0f%%\n", n, threads, 2.0 * n * n * n / elapsed.count() / 1e9,
+                   base / elapsed.count(), 100.0 * base / elapsed.count() / threads);
+            fflush(stdout);
+        }
+    }
+}
+
+// Пакет из count умножений n×n: отдельные вызовы gemm против одного gemm_batched.
+// На маленьких n время уходит не на арифметику, а на накладные расходы вызова.
+void benchmark_batched(const std::vector<size_t>& sizes, size_t threads) {
+    const size_t count = 10000;
+    printf("%6s %8s %14s %14s\n", "n", "count", "gemm us/op", "batched us/op");
+    std::mt19937 gen(42);
+    for (size_t n : sizes) {
+        std::vector<float> a(count * n * n), b(count * n * n), c(count * n * n);
+        fill_random(a, gen);
+        fill_random(b, gen);
+        std::vector<GemmBatchEntry<float, float>> entries;
+        for (size_t e = 0; e < count; ++e) {
+            entries.push_back({MatrixView<const float>(a.data() + e * n * n, n, n),
+                               MatrixView<const float>(b.data() + e * n * n, n, n),
+                               MatrixView<float>(c.data() + e * n * n, n, n)});
+        }
+
+        // прогрев: пул, арены потоков и страницы C
+        gemm_batched(no_transpose, no_transpose, 1.0f, entries.data(), entries.size(), 0.0f, threads);
+
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& entry : entries)
+            gemm(no_transpose, no_transpose, 1.0f, entry.a, entry.b, 0.0f, entry.c, threads);
+        std::chrono::duration<double> single = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        gemm_batched(no_transpose, no_transpose, 1.0f, entries.data(), entries.size(), 0.0f, threads);
+        std::chrono::duration<double> batched = std::chrono::steady_clock::now() - start;
+
+        printf("%6zu %8zu %14.3f %14.3f\n", n, count, single.count() / count * 1e6, batched.count() / count * 1e6);
+        fflush(stdout);
+    }
+}
+
+// Strassen против обычной рекурсии на float n×n с 1, 2, ... уровнями Strassen.
+// err - max|C - C_ref| / (u ||A|| ||B||), где C_ref посчитана с накоплением в double,
+// ||X|| = max |x_ij|, u = 2^-24. bound - оценка худшего случая для Winograd в тех же
+// единицах (Higham, "Accuracy and Stability of Numerical Algorithms", гл. 23):
+// (n/n0)^log2(18) (n0^2 + 6 n0) - 6n, n0 - размер листа Strassen; без Strassen это n^2.
+void benchmark_strassen(const std::vector<size_t>& sizes, size_t threads) {
+    const size_t min_leaf = 64;
+    const size_t saved_crossover = strassen_crossover;
+    printf("%6s %7s %10s %10s %10s %10s %12s\n", "n", "levels", "crossover", "seconds", "speedup", "err", "bound");
+    std::mt19937 gen(42);
+    for (size_t n : sizes) {
+        std::vector<float> a(n * n), b(n * n), c(n * n);
+        std::vector<double> reference(n * n);
+        fill_random(a, gen);
+        fill_random(b, gen);
+        strassen_crossover = 0;
+        matrix_multiply(a, b, reference, n, n, n, threads);
+        double norm_a = 0, norm_b = 0;
+        for (size_t i = 0; i < a.size(); ++i) {
+            norm_a = std::max(norm_a, std::fabs(static_cast<double>(a[i])));
+            norm_b = std::max(norm_b, std::fabs(static_cast<double>(b[i])));
+        }
+        const double unit = std::ldexp(1.0, -24) * norm_a * norm_b;
+
+        double classical = 0;
+        for (size_t levels = 0; levels == 0 || (n >> levels) >= min_leaf; ++levels) {
+            // crossover = n >> (levels - 1) дает ровно levels уровней
+            strassen_crossover = levels == 0 ? 0 : n >> (levels - 1);
+            auto start = std::chrono::steady_clock::now();
+            matrix_multiply(a, b, c, n, n, n, threads);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (levels == 0) classical = elapsed.count();
+
+            double error = 0;
+            for (size_t i = 0; i < c.size(); ++i) error = std::max(error, std::fabs(c[i] - reference[i]));
+            const double leaf = static_cast<double>(n >> levels);
+            const double bound = std::pow(n / leaf, std::log2(18.0)) * (leaf * leaf + 6 * leaf) - 6.0 * (n - leaf);
+            printf("%6zu %7zu %10zu %10.3f %10.2f %10.1f %12.3g\n", n, levels, strassen_crossover,
+                   elapsed.count(), classical / elapsed.count(), error / unit, bound);
+            fflush(stdout);
+        }
+    }
+    strassen_crossover = saved_crossover;
+}
+
+// Разреженная A n×n с долей ненулевых density на плотной B (f32): плотное умножение,
+// явные CSR×плотная и плотная×CSR (та же матрица справа, время без перевода в CSR) и
+// автоматический выбор с порогом sparse_threshold, который сам считает долю и строит CSR.
+// Затем треугольная и симметричная A против общей той же плотности.
+void benchmark_sparse(const std::vector<size_t>& sizes, size_t threads) {
+    const double densities[] = {0.5, 0.2, 0.1, 0.05, 0.02, 0.01, 0.001};
+    const double saved_threshold = sparse_threshold;
+    auto time = [](const std::function<void()>& fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    };
+    std::mt19937 gen(42);
+    printf("%6s %8s %10s %10s %10s %10s\n", "n", "density", "dense", "csr*dense", "dense*csr", "auto");
+    for (size_t n : sizes) {
+        std::vector<float> a(n * n), b(n * n), c(n * n);
+        fill_random(b, gen);
+        MatrixView<const float> view_a(a.data(), n, n), view_b(b.data(), n, n);
+        MatrixView<float> view_c(c.data(), n, n);
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        for (double density : densities) {
+            fill_random(a, gen);
+            for (float& value : a)
+                if (coin(gen) >= density) value = 0;
+            const CsrMatrix<float> csr = to_csr(view_a, no_transpose);
+
+            sparse_threshold = 0;
+            double dense = time([&] { gemm(no_transpose, no_transpose, 1.0f, view_a, view_b, 0.0f, view_c, threads); });
+            double csr_dense = time([&] { gemm(no_transpose, no_transpose, 1.0f, csr, view_b, 0.0f, view_c, threads); });
+            double dense_csr = time([&] { gemm(no_transpose, no_transpose, 1.0f, view_b, csr, 0.0f, view_c, threads); });
+            sparse_threshold = saved_threshold;
+            double automatic = time([&] { gemm(no_transpose, no_transpose, 1.0f, view_a, view_b, 0.0f, view_c, threads); });
+            printf("%6zu %8.3f %10.4f %10.4f %10.4f %10.4f\n", n, density, dense, csr_dense, dense_csr, automatic);
+            fflush(stdout);
+        }
+    }
+
+    const MatrixStructure structures[] = {general, lower_triangular, symmetric_lower};
+    const char* const structure_names[] = {"general", "lower", "symmetric"};
+    printf("\n%6s %10s %10s %10s\n", "n", "structure", "seconds", "speedup");
+    sparse_threshold = 0;
+    for (size_t n : sizes) {
+        std::vector<float> a(n * n), b(n * n), c(n * n);
+        fill_random(a, gen);
+        fill_random(b, gen);
+        double base = 0;
+        for (size_t s = 0; s < 3; ++s) {
+            MatrixView<const float> view_a(a.data(), n, n, n, structures[s]), view_b(b.data(), n, n);
+            MatrixView<float> view_c(c.data(), n, n);
+            double seconds =
+                time([&] { gemm(no_transpose, no_transpose, 1.0f, view_a, view_b, 0.0f, view_c, threads); });
+            if (s == 0) base = seconds;
+            printf("%6zu %10s %10.4f %10.2f\n", n, structure_names[s], seconds, base / seconds);
+            fflush(stdout);
+        }
+    }
+    sparse_threshold = saved_threshold;
+}
+
+// Размеры кэшей cpu0 из sysfs в байтах; 0 - если узнать не удалось.
+struct CacheSizes {
+    size_t l1d;
+    size_t l2;
+    size_t l3;
+};
+
+std::string read_first_word(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) return "";
+    char word[64] = {};
+    if (fscanf(file, "%63s", word) != 1) word[0] = '\0';
+    fclose(file);
+    return word;
+}
+
+// "48K", "2048K", "105M", "4G" -> байты
+size_t parse_cache_size(const std::string& text) {
+    char* end;
+    size_t value = strtoull(text.c_str(), &end, 10);
+    if (*end == 'K') value <<= 10;
+    else if (*end == 'M') value <<= 20;
+    else if (*end == 'G') value <<= 30;
+    return value;
+}
+
+CacheSizes detect_cache_sizes() {
+    CacheSizes caches = {0, 0, 0};
+    for (int index = 0;; ++index) {
+        std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        std::string level = read_first_word(dir + "level");
+        if (level.empty()) break;
+        std::string type = read_first_word(dir + "type");
+        size_t size = parse_cache_size(read_first_word(dir + "size"));
+        if (level == "1" && type == "Data") caches.l1d = size;
+        else if (level == "2" && type != "Instruction") caches.l2 = size;
+        else if (level == "3" && type != "Instruction") caches.l3 = size;
+    }
+    return caches;
+}
+
+// Начальная точка поиска: полосы MR×k и k×NR микроядра занимают половину L1,
+// блок B k×leaf_mn - половину L2. Если sysfs нет, считаем L1 = 32K и L2 = 1M.
+GemmTuning seed_tuning(const CacheSizes& caches, const MicroKernel<float, float>& kernel) {
+    const size_t max_leaf = 1024;
+    const size_t l1 = caches.l1d ? caches.l1d : size_t(32) << 10;
+    const size_t l2 = caches.l2 ? caches.l2 : size_t(1) << 20;
+    size_t leaf_k = 16;
+    while ((kernel.mr + kernel.nr) * leaf_k * 2 * sizeof(float) <= l1 / 2 && leaf_k * 2 <= max_leaf) leaf_k *= 2;
+    size_t leaf_mn = max_nr;
+    while (leaf_k * leaf_mn * 2 * sizeof(float) <= l2 / 2 && leaf_mn * 2 <= max_leaf) leaf_mn *= 2;
+    return {leaf_mn, leaf_k, split_largest};
+}
+
+// Перебор вокруг seed_tuning: leaf_mn и leaf_k в 2 раза меньше, такие же и в 2 раза
+// больше, с каждым порядком разбиения, плюс прежние 64×64×64 для сравнения.
+// Каждый вариант - лучшее из трех умножений float n×n в одном потоке (настраивается
+// последовательная рекурсия, поток - ее единица работы), без Strassen.
+GemmTuning autotune(size_t n) {
+    const MicroKernel<float, float>& kernel = micro_kernel<float, float>;
+    const CacheSizes caches = detect_cache_sizes();
+    const GemmTuning seed = seed_tuning(caches, kernel);
+    fprintf(stderr, "micro-kernel %s (%zux%zu), L1d %zuK, L2 %zuK, L3 %zuK, seed leaf %zu/%zu\n", kernel.name,
+            kernel.mr, kernel.nr, caches.l1d >> 10, caches.l2 >> 10, caches.l3 >> 10, seed.leaf_mn, seed.leaf_k);
+
+    std::vector<GemmTuning> candidates = {{64, 64, split_largest}};
+    for (size_t leaf_mn : {seed.leaf_mn / 2, seed.leaf_mn, seed.leaf_mn * 2}) {
+        for (size_t leaf_k : {seed.leaf_k / 2, seed.leaf_k, seed.leaf_k * 2}) {
+            for (SplitOrder split : {split_largest, split_mn_first, split_k_first})
+                candidates.push_back({std::max(leaf_mn, max_nr), leaf_k, split});
+        }
+    }
+
+    std::vector<float> a(n * n), b(n * n), c(n * n);
+    std::mt19937 gen(42);
+    fill_random(a, gen);
+    fill_random(b, gen);
+    const size_t saved_crossover = strassen_crossover;
+    strassen_crossover = 0;
+
+    GemmTuning best = candidates.front();
+    double best_gflops = 0;
+    printf("%8s %8s %10s %10s\n", "leaf_mn", "leaf_k", "split", "GFLOP/s");
+    for (const GemmTuning& candidate : candidates) {
+        gemm_tuning = candidate;
+        double fastest = 0;
+        for (int run = 0; run < 3; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            matrix_multiply(a, b, c, n, n, n, 1);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (run == 0 || elapsed.count() < fastest) fastest = elapsed.count();
+        }
+        double gflops = 2.0 * n * n * n / fastest / 1e9;
+        printf("%8zu %8zu %10s %10.2f\n", candidate.leaf_mn, candidate.leaf_k, split_order_names[candidate.split],
+               gflops);
+        fflush(stdout);
+        if (gflops > best_gflops) {
+            best_gflops = gflops;
+            best = candidate;
+        }
+    }
+    strassen_crossover = saved_crossover;
+    gemm_tuning = best;
+    return best;
+}
+
+// Файл настройки - строки key=value. kernel - ядро, под которое подбирали: с другим
+// ядром (другие MR и NR) настройка не применяется.
+std::string default_tuning_path() {
+    const char* home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.task4_gemm";
+}
+
+bool save_tuning(const std::string& path, const GemmTuning& tuning, const char* kernel) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "kernel=%s\nleaf_mn=%zu\nleaf_k=%zu\nsplit=%s\n", kernel, tuning.leaf_mn, tuning.leaf_k,
+            split_order_names[tuning.split]);
+    return fclose(file) == 0;
+}
+
+// false - файла нет, он испорчен или подобран для другого ядра; gemm_tuning тогда не меняется
+bool load_tuning(const std::string& path, const char* kernel) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) return false;
+    GemmTuning tuning = gemm_tuning;
+    std::string tuned_kernel;
+    bool valid = true;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* value = strchr(line, '=');
+        if (!value) continue;
+        *value++ = '\0';
+        if (strcmp(line, "kernel") == 0) {
+            tuned_kernel = value;
+        } else if (strcmp(line, "leaf_mn") == 0) {
+            tuning.leaf_mn = strtoull(value, nullptr, 10);
+        } else if (strcmp(line, "leaf_k") == 0) {
+            tuning.leaf_k = strtoull(value, nullptr, 10);
+        } else if (strcmp(line, "split") == 0) {
+            auto name = std::find_if(std::begin(split_order_names), std::end(split_order_names),
+                                     [&](const char* n) { return strcmp(n, value) == 0; });
+            valid = valid && name != std::end(split_order_names);
+            if (valid) tuning.split = static_cast<SplitOrder>(name - std::begin(split_order_names));
+        }
+    }
+    fclose(file);
+    // лист уже полосы ядра или K меньше пары не дали бы рекурсии уменьшить блок
+    if (!valid || tuned_kernel != kernel || tuning.leaf_mn < max_nr || tuning.leaf_k < 2) return false;
+    gemm_tuning = tuning;
+    return true;
+}
+
+// int8 через >> читался бы как символ
+template <typename T>
+void read_value(T& value) {
+    std::cin >> value;
+}
 
-    std::fill(result_matrix.begin(), result_matrix.end(), 0.0f);
-    matrix_multiply_recursive(matrix_a, matrix_b, result_matrix, M, K, N, K, N);
+void read_value(int8_t& value) {
+    int number;
+    std::cin >> number;
+    value = static_cast<int8_t>(number);
 }
 
-int main() {
+// M K N, затем A и B по строкам со стандартного ввода; результат - по строкам
+template <typename In, typename Acc>
+void multiply_stdin(size_t threads) {
     size_t M;
     size_t K;
     size_t N;
@@ -71,19 +2027,19 @@ int main() {
     std::cin >> K;
     std::cin >> N;
 
-    std::vector<float> matrix_a(M * K);
-    std::vector<float> matrix_b(K * N);
-    std::vector<float> result (M * N, 0);
+    std::vector<In> matrix_a(M * K);
+    std::vector<In> matrix_b(K * N);
+    std::vector<Acc> result (M * N, 0);
 
 
     for (size_t i = 0; i < matrix_a.size(); ++i) {
-        std::cin >> matrix_a[i];
+        read_value(matrix_a[i]);
     }
     for (size_t i = 0; i < matrix_b.size(); ++i) {
-        std::cin >> matrix_b[i];
+        read_value(matrix_b[i]);
     }
 
-    matrix_multiply(matrix_a, matrix_b, result, M, K, N);
+    matrix_multiply(matrix_a, matrix_b, result, M, K, N, threads);
 
     for (size_t i = 0; i < result.size(); ++i) {
         if (i % N == 0) {
@@ -91,7 +2047,836 @@ int main() {
         }
         std::cout << result[i] << ' ';
     }
+}
+
+// Двоичный файл матрицы: заголовок MatrixFileHeader (64 байта), с data_offset - числа
+// без разделителей. data_offset кратен 64, а отображение начинается с границы страницы,
+// так что данные в памяти выровнены по строке кэша. Элемент (i, j) лежит в
+// data[i * ld + j] при row_major и в data[j * ld + i] при column_major - второй случай
+// умножается как транспонированная матрица без копирования.
+enum MatrixDtype { dtype_f32 = 1, dtype_f64, dtype_i8, dtype_i16, dtype_i32 };
+enum MatrixLayout { row_major, column_major };
+const char matrix_file_magic[8] = {'T', '4', 'M', 'A', 'T', 'R', 'I', 'X'};
+const uint32_t matrix_file_version = 1;
+
+struct MatrixFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layout;
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t ld;
+    uint64_t data_offset;
+    char padding[8];
+};
+static_assert(sizeof(MatrixFileHeader) == cache_line, "Matrix file header must be one cache line");
+
+template <typename T>
+uint32_t dtype_of() {
+    if (std::is_same<T, float>::value) return dtype_f32;
+    if (std::is_same<T, double>::value) return dtype_f64;
+    if (std::is_same<T, int8_t>::value) return dtype_i8;
+    if (std::is_same<T, int16_t>::value) return dtype_i16;
+    return dtype_i32;
+}
+
+size_t dtype_size(uint32_t dtype) {
+    switch (dtype) {
+    case dtype_f32: return sizeof(float);
+    case dtype_f64: return sizeof(double);
+    case dtype_i8: return sizeof(int8_t);
+    case dtype_i16: return sizeof(int16_t);
+    case dtype_i32: return sizeof(int32_t);
+    default: return 0;
+    }
+}
+
+// Заголовок описывает матрицу, целиком лежащую в файле из file_size байт
+bool valid_matrix_header(const MatrixFileHeader& h, size_t file_size) {
+    const size_t size = dtype_size(h.dtype);
+    const uint64_t lines = h.layout == row_major ? h.rows : h.cols;
+    const uint64_t line = h.layout == row_major ? h.cols : h.rows;
+    if (memcmp(h.magic, matrix_file_magic, sizeof(h.magic)) != 0 || h.version != matrix_file_version ||
+        size == 0 || h.layout > column_major || h.ld < line || h.data_offset % cache_line != 0 ||
+        h.data_offset < sizeof(MatrixFileHeader)) {
+        return false;
+    }
+    if (lines == 0) return true;
+    // конец последней строки data_offset + ((lines - 1) * ld + line) * size; поля из файла
+    // не проверены, поэтому переполнение - тоже отказ
+    uint64_t end;
+    return !__builtin_mul_overflow(lines - 1, h.ld, &end) && !__builtin_add_overflow(end, line, &end) &&
+           !__builtin_mul_overflow(end, size, &end) && !__builtin_add_overflow(end, h.data_offset, &end) &&
+           end <= file_size;
+}
+
+// Размер файла rows×cols по строкам вместе с заголовком; false, если он не представим в off_t
+bool matrix_file_bytes(uint32_t dtype, size_t rows, size_t cols, size_t& bytes) {
+    return !__builtin_mul_overflow(rows, cols, &bytes) && !__builtin_mul_overflow(bytes, dtype_size(dtype), &bytes) &&
+           !__builtin_add_overflow(bytes, sizeof(MatrixFileHeader), &bytes) &&
+           bytes <= static_cast<size_t>(std::numeric_limits<off_t>::max());
+}
+
+// false с errno; EINVAL - не файл матрицы
+bool read_matrix_header(int fd, MatrixFileHeader& h) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) return false;
+    if (pread(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h)) || !valid_matrix_header(h, info.st_size)) {
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+// Новый файл rows×cols по строкам, заполненный нулями; дескриптор для чтения и записи или -1
+// с errno (EFBIG - такой файл не представим)
+int create_matrix_file(const std::string& path, uint32_t dtype, size_t rows, size_t cols) {
+    size_t bytes;
+    if (!matrix_file_bytes(dtype, rows, cols, bytes)) {
+        errno = EFBIG;
+        return -1;
+    }
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    MatrixFileHeader h = {};
+    memcpy(h.magic, matrix_file_magic, sizeof(h.magic));
+    h.version = matrix_file_version;
+    h.dtype = dtype;
+    h.layout = row_major;
+    h.rows = rows;
+    h.cols = cols;
+    h.ld = cols;
+    h.data_offset = sizeof(MatrixFileHeader);
+    if (ftruncate(fd, bytes) != 0 ||
+        pwrite(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// Файл матрицы, отображенный в память. Данные заранее не читаются: страницы подгружаются
+// при первом обращении, поэтому операнд может быть и больше памяти. Ошибки - false с errno
+// (EINVAL - не тот формат), как у open и mmap.
+class MappedMatrix {
+public:
+    MappedMatrix() : base(nullptr), length(0) {}
+    MappedMatrix(const MappedMatrix&) = delete;
+    MappedMatrix& operator=(const MappedMatrix&) = delete;
+
+    ~MappedMatrix() {
+        if (base) munmap(base, length);
+    }
+
+    // только для чтения
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        MatrixFileHeader h;
+        bool ok = read_matrix_header(fd, h) && fstat(fd, &info) == 0 && map(fd, info.st_size, PROT_READ);
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return ok;
+    }
+
+    // новый файл rows×cols по строкам, открытый для записи; содержимое - нули
+    bool create(const std::string& path, uint32_t dtype, size_t rows, size_t cols) {
+        size_t bytes;
+        if (!matrix_file_bytes(dtype, rows, cols, bytes)) {
+            errno = EFBIG;
+            return false;
+        }
+        int fd = create_matrix_file(path, dtype, rows, cols);
+        if (fd < 0) return false;
+        bool ok = map(fd, bytes, PROT_READ | PROT_WRITE);
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return ok;
+    }
+
+    const MatrixFileHeader& header() const {
+        return *static_cast<const MatrixFileHeader*>(base);
+    }
+
+    // матрица в том виде, как лежит в файле; для column_major это транспонированная
+    template <typename T>
+    MatrixView<T> stored() const {
+        const MatrixFileHeader& h = header();
+        T* data = reinterpret_cast<T*>(static_cast<char*>(base) + h.data_offset);
+        if (h.layout == row_major) return MatrixView<T>(data, h.rows, h.cols, h.ld);
+        return MatrixView<T>(data, h.cols, h.rows, h.ld);
+    }
+
+    Transpose op() const {
+        return header().layout == row_major ? no_transpose : transpose;
+    }
+
+private:
+    bool map(int fd, size_t bytes, int protection) {
+        if (bytes == 0) {
+            errno = EINVAL;
+            return false;
+        }
+        void* address = mmap(nullptr, bytes, protection, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) return false;
+        base = address;
+        length = bytes;
+        return true;
+    }
+
+    void* base;
+    size_t length;
+};
+
+// C = A * B по файлам: A и B только отображаются, C создается и отображается для
+// записи, так что произведение пишется прямо в файл без разбора и печати текста
+template <typename In, typename Acc>
+int multiply_files(const MappedMatrix& a, const MappedMatrix& b, const std::string& out, size_t threads) {
+    MatrixView<const In> view_a = a.stored<const In>();
+    MatrixView<const In> view_b = b.stored<const In>();
+    if (op_cols(view_a, a.op()) != op_rows(view_b, b.op())) {
+        fprintf(stderr, "Размеры матриц не совпадают\n");
+        return 1;
+    }
+    MappedMatrix c;
+    if (!c.create(out, dtype_of<Acc>(), op_rows(view_a, a.op()), op_cols(view_b, b.op()))) {
+        perror(out.c_str());
+        return 1;
+    }
+    gemm(a.op(), b.op(), Acc(1), view_a, view_b, Acc(0), c.stored<Acc>(), threads);
+    return 0;
+}
+
+// Умножение во внешней памяти: A, B и C остаются в файлах, а в памяти одновременно
+// лежит не больше budget байт их плиток. Плитки - клетки сетки tile×tile в координатах
+// op(A), op(B) и C. Листья перебираются в том же рекурсивном порядке, что и в
+// matrix_multiply_recursive (choose_split по числу плиток, лист - одна тройка плиток),
+// а плитки держатся в кэше с вытеснением давно не использованной. Рекурсивный порядок
+// не зависит от размера кэша, поэтому число чтений с диска близко к оптимальному при
+// любом budget - так же, как рекурсия сама приспосабливается к кэшам процессора.
+// Плитки следующего листа читаются отдельным потоком, пока считается текущий.
+struct OutOfCoreStats {
+    size_t tile;
+    size_t leaves;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+};
+
+// Открытый файл матрицы и то, как его хранимая матрица связана с операндом
+struct MatrixFile {
+    int fd;
+    MatrixFileHeader header;
+    Transpose op;
+};
+
+// Блок rows×cols хранимой матрицы с (row, col) читается в buffer или пишется из него;
+// в buffer блок лежит по строкам без промежутков
+bool transfer_block(const MatrixFile& file, size_t row, size_t col, size_t rows, size_t cols, char* buffer,
+                    bool write) {
+    const size_t size = dtype_size(file.header.dtype);
+    const size_t line = cols * size;
+    for (size_t i = 0; i < rows; ++i) {
+        const off_t offset = file.header.data_offset + ((row + i) * file.header.ld + col) * size;
+        ssize_t done = write ? pwrite(file.fd, buffer + i * line, line, offset)
+                             : pread(file.fd, buffer + i * line, line, offset);
+        if (done != static_cast<ssize_t>(line)) {
+            if (done >= 0) errno = EIO;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Сторона плитки: в budget должны помещаться 16 самых крупных плиток (не меньше 64×64),
+// из них до трех - под чтение следующего листа, так что кэшу остается с запасом
+template <typename In, typename Acc>
+size_t out_of_core_tile(size_t budget) {
+    const size_t element = std::max(sizeof(In), sizeof(Acc));
+    size_t tile = static_cast<size_t>(std::sqrt(static_cast<double>(budget / 16 / element))) / 64 * 64;
+    if (tile < 64) throw std::invalid_argument("Memory budget is too small for out-of-core multiplication");
+    return tile;
+}
+
+template <typename In, typename Acc>
+class OutOfCoreGemm {
+public:
+    OutOfCoreGemm(const MatrixFile& a, const MatrixFile& b, const MatrixFile& c, size_t budget, size_t threads)
+        : files{a, b, c},
+          M(c.header.rows),
+          K(a.header.cols),
+          N(c.header.cols),
+          threads(threads),
+          clock(0),
+          cached_bytes(0) {
+        stats = {out_of_core_tile<In, Acc>(budget), 0, 0, 0};
+        const size_t largest = stats.tile * stats.tile * std::max(sizeof(In), sizeof(Acc));
+        capacity = budget - 3 * largest;
+        grid[0] = (M + stats.tile - 1) / stats.tile;
+        grid[1] = (K + stats.tile - 1) / stats.tile;
+        grid[2] = (N + stats.tile - 1) / stats.tile;
+    }
+
+    // false с errno при ошибке ввода-вывода
+    bool run() {
+        std::vector<Leaf> leaves;
+        if (M && K && N) collect_leaves(leaves, 0, 0, 0, grid[0], grid[1], grid[2]);
+        stats.leaves = leaves.size();
+        if (leaves.empty()) return true;
+
+        auto next = std::async(std::launch::async, &OutOfCoreGemm::load, this, missing(leaves[0]));
+        for (size_t l = 0; l < leaves.size(); ++l) {
+            std::vector<Tile> loaded = next.get();
+            if (!place(leaves[l], loaded)) return false;
+            if (l + 1 < leaves.size())
+                next = std::async(std::launch::async, &OutOfCoreGemm::load, this, missing(leaves[l + 1]));
+            multiply(leaves[l]);
+        }
+        for (auto& entry : cache)
+            if (!flush(entry.first, entry.second)) return false;
+        return true;
+    }
+
+    const OutOfCoreStats& report() const {
+        return stats;
+    }
+
+private:
+    // клетка (row, col) сетки плиток матрицы which: 0 - op(A), 1 - op(B), 2 - C
+    struct Key {
+        int which;
+        size_t row;
+        size_t col;
+
+        bool operator<(const Key& other) const {
+            if (which != other.which) return which < other.which;
+            if (row != other.row) return row < other.row;
+            return col < other.col;
+        }
+
+        bool operator==(const Key& other) const {
+            return which == other.which && row == other.row && col == other.col;
+        }
+    };
+
+    struct Tile {
+        Key key;
+        std::vector<char> data;
+        bool from_disk;
+        bool dirty;
+        size_t last_use;
+        bool error;
+        int saved_errno;
+    };
+
+    struct Leaf {
+        size_t i;
+        size_t p;
+        size_t j;
+    };
+
+    // та же рекурсия, что в памяти, только размеры - в плитках, а лист - одна плитка
+    void collect_leaves(std::vector<Leaf>& leaves, size_t i0, size_t p0, size_t j0, size_t m, size_t k, size_t n) {
+        if (m == 1 && k == 1 && n == 1) {
+            leaves.push_back({i0, p0, j0});
+            return;
+        }
+        const GemmTuning tiles = {1, 1, gemm_tuning.split};
+        SplitDim dim = choose_split(tiles, m, k, n);
+        if (dim == split_m) {
+            collect_leaves(leaves, i0, p0, j0, m / 2, k, n);
+            collect_leaves(leaves, i0 + m / 2, p0, j0, m - m / 2, k, n);
+        } else if (dim == split_k) {
+            collect_leaves(leaves, i0, p0, j0, m, k / 2, n);
+            collect_leaves(leaves, i0, p0 + k / 2, j0, m, k - k / 2, n);
+        } else {
+            collect_leaves(leaves, i0, p0, j0, m, k, n / 2);
+            collect_leaves(leaves, i0, p0, j0 + n / 2, m, k, n - n / 2);
+        }
+    }
+
+    // размеры клетки в op-координатах
+    size_t extent(size_t index, size_t total) const {
+        return std::min(stats.tile, total - index * stats.tile);
+    }
+
+    size_t tile_rows(const Key& key) const {
+        return extent(key.row, key.which == 1 ? K : M);
+    }
+
+    size_t tile_cols(const Key& key) const {
+        return extent(key.col, key.which == 0 ? K : N);
+    }
+
+    size_t tile_bytes(const Key& key) const {
+        return tile_rows(key) * tile_cols(key) * (key.which == 2 ? sizeof(Acc) : sizeof(In));
+    }
+
+    std::vector<Key> leaf_keys(const Leaf& leaf) const {
+        return {{0, leaf.i, leaf.p}, {1, leaf.p, leaf.j}, {2, leaf.i, leaf.j}};
+    }
+
+    std::vector<Key> missing(const Leaf& leaf) const {
+        std::vector<Key> keys;
+        for (const Key& key : leaf_keys(leaf))
+            if (cache.find(key) == cache.end()) keys.push_back(key);
+        return keys;
+    }
+
+    // Хранимый блок клетки: для column_major файла это транспонированная клетка.
+    // Плитка C, которую еще ни разу не записывали, не читается - это нули.
+    bool transfer(Tile& tile, bool write) const {
+        const MatrixFile& file = files[tile.key.which];
+        const size_t rows = tile_rows(tile.key);
+        const size_t cols = tile_cols(tile.key);
+        const size_t row = tile.key.row * stats.tile;
+        const size_t col = tile.key.col * stats.tile;
+        if (file.op == no_transpose) return transfer_block(file, row, col, rows, cols, tile.data.data(), write);
+        return transfer_block(file, col, row, cols, rows, tile.data.data(), write);
+    }
+
+    // выполняется в потоке подкачки: трогает только свои плитки и written (только чтение)
+    std::vector<Tile> load(std::vector<Key> keys) const {
+        std::vector<Tile> tiles;
+        for (const Key& key : keys) {
+            Tile tile = {key, std::vector<char>(tile_bytes(key)), false, false, 0, false, 0};
+            tile.from_disk = key.which != 2 || written.count(key);
+            if (tile.from_disk && !transfer(tile, false)) {
+                tile.error = true;
+                tile.saved_errno = errno;
+            }
+            tiles.push_back(std::move(tile));
+        }
+        return tiles;
+    }
+
+    bool flush(const Key& key, Tile& tile) {
+        if (!tile.dirty) return true;
+        if (!transfer(tile, true)) return false;
+        stats.bytes_written += tile.data.size();
+        tile.dirty = false;
+        written.insert(key);
+        return true;
+    }
+
+    // Кладет в кэш подкачанные плитки листа, вытесняя давно не использованные плитки
+    // других листьев. Остальные плитки листа были в кэше, когда заказывали подкачку, а
+    // вытеснение с тех пор не трогает плитки этого листа - они на месте.
+    bool place(const Leaf& leaf, std::vector<Tile>& loaded) {
+        const std::vector<Key> keys = leaf_keys(leaf);
+        for (Tile& tile : loaded) {
+            if (tile.error) {
+                errno = tile.saved_errno;
+                return false;
+            }
+            if (!evict(tile.data.size(), keys)) return false;
+            if (tile.from_disk) stats.bytes_read += tile.data.size();
+            cached_bytes += tile.data.size();
+            Key key = tile.key;
+            cache.emplace(key, std::move(tile));
+        }
+        for (const Key& key : keys) cache.at(key).last_use = ++clock;
+        return true;
+    }
+
+    bool evict(size_t bytes, const std::vector<Key>& pinned) {
+        while (cached_bytes + bytes > capacity) {
+            auto victim = cache.end();
+            for (auto it = cache.begin(); it != cache.end(); ++it) {
+                if (std::find(pinned.begin(), pinned.end(), it->first) != pinned.end()) continue;
+                if (victim == cache.end() || it->second.last_use < victim->second.last_use) victim = it;
+            }
+            if (victim == cache.end()) break;
+            if (!flush(victim->first, victim->second)) return false;
+            cached_bytes -= victim->second.data.size();
+            cache.erase(victim);
+        }
+        return true;
+    }
+
+    MatrixView<const In> operand_view(const Tile& tile, Transpose op) const {
+        const size_t rows = tile_rows(tile.key);
+        const size_t cols = tile_cols(tile.key);
+        const In* data = reinterpret_cast<const In*>(tile.data.data());
+        if (op == no_transpose) return MatrixView<const In>(data, rows, cols);
+        return MatrixView<const In>(data, cols, rows);
+    }
+
+    void multiply(const Leaf& leaf) {
+        const Tile& a = cache.at({0, leaf.i, leaf.p});
+        const Tile& b = cache.at({1, leaf.p, leaf.j});
+        Tile& c = cache.at({2, leaf.i, leaf.j});
+        MatrixView<Acc> view_c(reinterpret_cast<Acc*>(c.data.data()), tile_rows(c.key), tile_cols(c.key));
+        gemm(files[0].op, files[1].op, Acc(1), operand_view(a, files[0].op), operand_view(b, files[1].op), Acc(1),
+             view_c, threads);
+        c.dirty = true;
+    }
+
+    MatrixFile files[3];
+    size_t M;
+    size_t K;
+    size_t N;
+    size_t threads;
+    size_t grid[3];
+    size_t capacity;
+    size_t clock;
+    size_t cached_bytes;
+    std::map<Key, Tile> cache;
+    // плитки C, уже записанные в файл
+    std::set<Key> written;
+    OutOfCoreStats stats;
+};
+
+// C = A * B во внешней памяти; отчет о прочитанном и записанном - в stderr
+template <typename In, typename Acc>
+int multiply_out_of_core(const std::string& a_path, const std::string& b_path, const std::string& out,
+                         size_t budget, size_t threads) {
+    try {
+        out_of_core_tile<In, Acc>(budget);
+    } catch (const std::invalid_argument& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    MatrixFile files[3] = {{-1, {}, no_transpose}, {-1, {}, no_transpose}, {-1, {}, no_transpose}};
+    // закрывает открытые файлы, сохраняя errno для perror
+    auto close_files = [&files] {
+        const int saved = errno;
+        for (const MatrixFile& file : files)
+            if (file.fd >= 0) close(file.fd);
+        errno = saved;
+    };
+    const std::string paths[2] = {a_path, b_path};
+    for (int f = 0; f < 2; ++f) {
+        files[f].fd = open(paths[f].c_str(), O_RDONLY);
+        if (files[f].fd < 0 || !read_matrix_header(files[f].fd, files[f].header)) {
+            close_files();
+            perror(paths[f].c_str());
+            return 1;
+        }
+        files[f].op = files[f].header.layout == row_major ? no_transpose : transpose;
+    }
+    // rows и cols в заголовке - размеры самой матрицы при любой раскладке
+    const MatrixFileHeader& a = files[0].header;
+    const MatrixFileHeader& b = files[1].header;
+    const size_t M = a.rows;
+    const size_t N = b.cols;
+    if (a.cols != b.rows) {
+        close_files();
+        fprintf(stderr, "Размеры матриц не совпадают\n");
+        return 1;
+    }
+    files[2].fd = create_matrix_file(out, dtype_of<Acc>(), M, N);
+    if (files[2].fd < 0 || !read_matrix_header(files[2].fd, files[2].header)) {
+        close_files();
+        perror(out.c_str());
+        return 1;
+    }
+
+    OutOfCoreGemm<In, Acc> job(files[0], files[1], files[2], budget, threads);
+    const bool ok = job.run();
+    close_files();
+    if (!ok) {
+        perror("out-of-core");
+        return 1;
+    }
+    const OutOfCoreStats& stats = job.report();
+    // для сравнения - сколько занимают сами A и B и C: меньше прочитать и записать нельзя
+    const unsigned long long operands = (a.rows * a.cols + b.rows * b.cols) * sizeof(In);
+    const unsigned long long result = M * N * sizeof(Acc);
+    fprintf(stderr, "out-of-core: tile %zu, %zu leaves, read %llu bytes (A+B %llu), written %llu bytes (C %llu)\n",
+            stats.tile, stats.leaves, static_cast<unsigned long long>(stats.bytes_read), operands,
+            static_cast<unsigned long long>(stats.bytes_written), result);
+    return 0;
+}
+
+// M K N, A и B со стандартного ввода (как без файлов) в двоичные файлы a_path и b_path
+template <typename In>
+int convert_stdin(const std::string& a_path, const std::string& b_path) {
+    size_t M;
+    size_t K;
+    size_t N;
+    std::cin >> M >> K >> N;
+    MappedMatrix a;
+    MappedMatrix b;
+    if (!a.create(a_path, dtype_of<In>(), M, K)) {
+        perror(a_path.c_str());
+        return 1;
+    }
+    if (!b.create(b_path, dtype_of<In>(), K, N)) {
+        perror(b_path.c_str());
+        return 1;
+    }
+    MatrixView<In> view_a = a.stored<In>();
+    MatrixView<In> view_b = b.stored<In>();
+    for (size_t i = 0; i < M * K; ++i) read_value(view_a.data[i]);
+    for (size_t i = 0; i < K * N; ++i) read_value(view_b.data[i]);
+    return 0;
+}
+
+// матрица из файла текстом, как печатает умножение со стандартного ввода
+template <typename T>
+void print_matrix(const MappedMatrix& matrix) {
+    MatrixView<const T> view = matrix.stored<const T>();
+    const bool transposed = matrix.op() == transpose;
+    const size_t rows = op_rows(view, matrix.op());
+    const size_t cols = op_cols(view, matrix.op());
+    for (size_t i = 0; i < rows; ++i) {
+        std::cout << '\n';
+        for (size_t j = 0; j < cols; ++j) {
+            // + печатает int8 числом, а не символом
+            std::cout << +(transposed ? view.data[j * view.ld + i] : view.data[i * view.ld + j]) << ' ';
+        }
+    }
+}
+
+// A и B - файлы одного типа; --type=f32f64 для f32 копит в double, целые - в int32.
+// budget > 0 - умножение во внешней памяти не больше чем с budget байт плиток.
+int multiply_files(const std::string& a_path, const std::string& b_path, const std::string& out,
+                   const std::string& type, size_t budget, size_t threads) {
+    // типы элементов - из одних заголовков: с budget файлы не отображаются
+    const std::string paths[2] = {a_path, b_path};
+    MatrixFileHeader headers[2];
+    for (int f = 0; f < 2; ++f) {
+        int fd = open(paths[f].c_str(), O_RDONLY);
+        bool ok = fd >= 0 && read_matrix_header(fd, headers[f]);
+        int saved = errno;
+        if (fd >= 0) close(fd);
+        errno = saved;
+        if (!ok) {
+            perror(paths[f].c_str());
+            return 1;
+        }
+    }
+    const uint32_t dtype = headers[0].dtype;
+    if (dtype != headers[1].dtype) {
+        fprintf(stderr, "Типы элементов A и B не совпадают\n");
+        return 1;
+    }
+    if (budget) {
+        switch (dtype) {
+        case dtype_f32:
+            if (type == "f32f64") return multiply_out_of_core<float, double>(a_path, b_path, out, budget, threads);
+            return multiply_out_of_core<float, float>(a_path, b_path, out, budget, threads);
+        case dtype_f64: return multiply_out_of_core<double, double>(a_path, b_path, out, budget, threads);
+        case dtype_i8: return multiply_out_of_core<int8_t, int32_t>(a_path, b_path, out, budget, threads);
+        case dtype_i16: return multiply_out_of_core<int16_t, int32_t>(a_path, b_path, out, budget, threads);
+        default: break;
+        }
+    }
+    MappedMatrix a;
+    MappedMatrix b;
+    if (!a.open(a_path)) {
+        perror(a_path.c_str());
+        return 1;
+    }
+    if (!b.open(b_path)) {
+        perror(b_path.c_str());
+        return 1;
+    }
+    switch (dtype) {
+    case dtype_f32:
+        if (type == "f32f64") return multiply_files<float, double>(a, b, out, threads);
+        return multiply_files<float, float>(a, b, out, threads);
+    case dtype_f64: return multiply_files<double, double>(a, b, out, threads);
+    case dtype_i8: return multiply_files<int8_t, int32_t>(a, b, out, threads);
+    case dtype_i16: return multiply_files<int16_t, int32_t>(a, b, out, threads);
+    default:
+        fprintf(stderr, "Матрицы int32 бывают только результатом\n");
+        return 1;
+    }
+}
+
+int print_file(const std::string& path) {
+    MappedMatrix matrix;
+    if (!matrix.open(path)) {
+        perror(path.c_str());
+        return 1;
+    }
+    switch (matrix.header().dtype) {
+    case dtype_f32: print_matrix<float>(matrix); break;
+    case dtype_f64: print_matrix<double>(matrix); break;
+    case dtype_i8: print_matrix<int8_t>(matrix); break;
+    case dtype_i16: print_matrix<int16_t>(matrix); break;
+    default: print_matrix<int32_t>(matrix); break;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // task4 [--kernel=scalar|sse|avx2|avx512] [--type=f32|f64|f32f64|i8|i16] [--threads=N]
+    //       [--grain=FLOPS] [--strassen=CROSSOVER] [--bench[=N,N,...]] [--bench-scaling[=N,N,...]]
+    //       [--bench-batch[=N,N,...]] [--bench-strassen[=N,N,...]] [--bench-sparse[=N,N,...]]
+    //       [--sparse-threshold=DENSITY] [--autotune[=N]] [--tuning=FILE]
+    //       [--a=FILE --b=FILE --out=FILE [--budget=BYTES]] [--to-binary=A_FILE,B_FILE] [--print=FILE]
+    // настройка листа рекурсии читается из FILE (по умолчанию ~/.task4_gemm), если она
+    // подобрана для выбранного ядра; --autotune подбирает ее заново и записывает туда же
+    // без --bench матрицы читаются со стандартного ввода: M K N, затем A и B по строкам;
+    // --type задает тип элементов (по умолчанию f32, а в --bench - все типы)
+    // --a, --b и --out - двоичные файлы матриц (MatrixFileHeader): A и B отображаются в
+    // память, C пишется прямо в отображенный --out; тип берется из файлов.
+    // С --budget (можно с K, M, G) A, B и C не отображаются целиком, а читаются и пишутся
+    // плитками, занимая не больше BYTES памяти (умножение во внешней памяти).
+    // --to-binary переводит текстовый ввод в такие файлы, --print печатает файл текстом
+    std::vector<size_t> bench_sizes;
+    std::vector<size_t> scaling_sizes;
+    std::vector<size_t> batch_sizes;
+    std::vector<size_t> strassen_sizes;
+    std::vector<size_t> sparse_sizes;
+    size_t autotune_size = 0;
+    std::string tuning_path = default_tuning_path();
+    std::string type;
+    std::string a_path;
+    std::string b_path;
+    std::string out_path;
+    std::string binary_paths;
+    std::string print_path;
+    size_t budget = 0;
+    size_t threads = 0;
+    auto parse_sizes = [](const char* text, std::vector<size_t>& sizes) {
+        for (char* p = const_cast<char*>(text); *p;) {
+            sizes.push_back(strtoull(p, &p, 10));
+            if (*p == ',') ++p;
+            else if (*p) break;
+        }
+    };
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            bench_sizes = {1024, 2048, 4096};
+        } else if (strncmp(argv[i], "--bench=", 8) == 0) {
+            parse_sizes(argv[i] + 8, bench_sizes);
+        } else if (strcmp(argv[i], "--bench-scaling") == 0) {
+            scaling_sizes = {2048, 4096};
+        } else if (strncmp(argv[i], "--bench-scaling=", 16) == 0) {
+            parse_sizes(argv[i] + 16, scaling_sizes);
+        } else if (strcmp(argv[i], "--bench-batch") == 0) {
+            batch_sizes = {4, 8, 16, 32};
+        } else if (strncmp(argv[i], "--bench-batch=", 14) == 0) {
+            parse_sizes(argv[i] + 14, batch_sizes);
+        } else if (strcmp(argv[i], "--bench-strassen") == 0) {
+            strassen_sizes = {2048, 4096};
+        } else if (strncmp(argv[i], "--bench-strassen=", 17) == 0) {
+            parse_sizes(argv[i] + 17, strassen_sizes);
+        } else if (strcmp(argv[i], "--bench-sparse") == 0) {
+            sparse_sizes = {1024, 2048};
+        } else if (strncmp(argv[i], "--bench-sparse=", 15) == 0) {
+            parse_sizes(argv[i] + 15, sparse_sizes);
+        } else if (strncmp(argv[i], "--sparse-threshold=", 19) == 0) {
+            // 0 - всегда плотное умножение
+            sparse_threshold = strtod(argv[i] + 19, nullptr);
+        } else if (strncmp(argv[i], "--strassen=", 11) == 0) {
+            // 0 - без Strassen
+            strassen_crossover = strtoull(argv[i] + 11, nullptr, 10);
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            autotune_size = 1024;
+        } else if (strncmp(argv[i], "--autotune=", 11) == 0) {
+            autotune_size = strtoull(argv[i] + 11, nullptr, 10);
+        } else if (strncmp(argv[i], "--a=", 4) == 0) {
+            a_path = argv[i] + 4;
+        } else if (strncmp(argv[i], "--b=", 4) == 0) {
+            b_path = argv[i] + 4;
+        } else if (strncmp(argv[i], "--out=", 6) == 0) {
+            out_path = argv[i] + 6;
+        } else if (strncmp(argv[i], "--to-binary=", 12) == 0) {
+            binary_paths = argv[i] + 12;
+            if (binary_paths.find(',') == std::string::npos) {
+                fprintf(stderr, "--to-binary ждет два файла через запятую\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+            budget = parse_cache_size(argv[i] + 9);
+        } else if (strncmp(argv[i], "--print=", 8) == 0) {
+            print_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--tuning=", 9) == 0) {
+            tuning_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            // 0 - по числу ядер
+            threads = strtoull(argv[i] + 10, nullptr, 10);
+        } else if (strncmp(argv[i], "--grain=", 8) == 0) {
+            parallel_grain = strtoull(argv[i] + 8, nullptr, 10);
+        } else if (strncmp(argv[i], "--type=", 7) == 0) {
+            type = argv[i] + 7;
+            if (std::find(std::begin(element_types), std::end(element_types), type) == std::end(element_types)) {
+                fprintf(stderr, "Неизвестный тип элементов: %s\n", type.c_str());
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+            // не у всех типов есть все ядра: такие типы остаются на своем лучшем ядре
+            bool found = select_micro_kernel<float, float>(argv[i] + 9);
+            found = select_micro_kernel<double, double>(argv[i] + 9) || found;
+            found = select_micro_kernel<int16_t, int32_t>(argv[i] + 9) || found;
+            if (!found) {
+                fprintf(stderr, "Ядро %s недоступно на этом процессоре\n", argv[i] + 9);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Неизвестный параметр: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (autotune_size) {
+        GemmTuning best = autotune(autotune_size);
+        fprintf(stderr, "best: leaf %zu/%zu, split %s\n", best.leaf_mn, best.leaf_k, split_order_names[best.split]);
+        if (!save_tuning(tuning_path, best, micro_kernel<float, float>.name)) {
+            perror(tuning_path.c_str());
+            return 1;
+        }
+        return 0;
+    }
+    load_tuning(tuning_path, micro_kernel<float, float>.name);
+
+    if (!bench_sizes.empty()) {
+        benchmark(bench_sizes, type, threads);
+        return 0;
+    }
+    if (!scaling_sizes.empty()) {
+        const MicroKernel<float, float>& kernel = micro_kernel<float, float>;
+        fprintf(stderr, "micro-kernel %s (%zux%zu), grain %zu\n", kernel.name, kernel.mr, kernel.nr, parallel_grain);
+        benchmark_scaling(scaling_sizes);
+        return 0;
+    }
+    if (!batch_sizes.empty()) {
+        benchmark_batched(batch_sizes, threads);
+        return 0;
+    }
+    if (!strassen_sizes.empty()) {
+        benchmark_strassen(strassen_sizes, threads);
+        return 0;
+    }
+    if (!sparse_sizes.empty()) {
+        benchmark_sparse(sparse_sizes, threads);
+        return 0;
+    }
+
+    if (!print_path.empty()) return print_file(print_path);
+    if (!binary_paths.empty()) {
+        const size_t comma = binary_paths.find(',');
+        const std::string first = binary_paths.substr(0, comma);
+        const std::string second = binary_paths.substr(comma + 1);
+        if (type == "f64") return convert_stdin<double>(first, second);
+        if (type == "i8") return convert_stdin<int8_t>(first, second);
+        if (type == "i16") return convert_stdin<int16_t>(first, second);
+        return convert_stdin<float>(first, second);
+    }
+    if (!a_path.empty() || !b_path.empty() || !out_path.empty()) {
+        if (a_path.empty() || b_path.empty() || out_path.empty()) {
+            fprintf(stderr, "Нужны все три файла: --a, --b и --out\n");
+            return 1;
+        }
+        return multiply_files(a_path, b_path, out_path, type, budget, threads);
+    }
 
+    if (type == "f64") multiply_stdin<double, double>(threads);
+    else if (type == "f32f64") multiply_stdin<float, double>(threads);
+    else if (type == "i8") multiply_stdin<int8_t, int32_t>(threads);
+    else if (type == "i16") multiply_stdin<int16_t, int32_t>(threads);
+    else multiply_stdin<float, float>(threads);
 }
 
 /*
@@ -2,6 +2,22 @@
 #include <vector>
 #include <algorithm>
 #include <limits>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RTREE_X86 1
+#endif
 
 struct Rectangle {
     float xMin, yMin, xMax, yMax;
@@ -25,6 +41,37 @@ struct Rectangle {
         xMax = std::max(xMax, other.xMax);
         yMax = std::max(yMax, other.yMax);
     }
+
+    // полупериметр
+    float margin() const {
+        return (xMax - xMin) + (yMax - yMin);
+    }
+
+    float overlapArea(const Rectangle& other) const {
+        float width = std::min(xMax, other.xMax) - std::max(xMin, other.xMin);
+        float height = std::min(yMax, other.yMax) - std::max(yMin, other.yMin);
+        return width > 0 && height > 0 ? width * height : 0;
+    }
+
+    // MINDIST: квадрат расстояния от точки до прямоугольника, 0 - точка внутри
+    double minDistance2(float x, float y) const {
+        double dx = std::max(0.0, std::max(static_cast<double>(xMin) - x, static_cast<double>(x) - xMax));
+        double dy = std::max(0.0, std::max(static_cast<double>(yMin) - y, static_cast<double>(y) - yMax));
+        return dx * dx + dy * dy;
+    }
+
+    // MINMAXDIST (Roussopoulos): квадрат расстояния, на котором внутри MBR наверняка есть
+    // объект. Каждая сторона MBR касается объекта, поэтому берется ближняя сторона по
+    // одной координате и дальний угол на ней по другой; минимум из двух вариантов.
+    double minMaxDistance2(float x, float y) const {
+        double nearX = x <= (xMin + xMax) / 2 ? xMin : xMax;
+        double farX = x >= (xMin + xMax) / 2 ? xMin : xMax;
+        double nearY = y <= (yMin + yMax) / 2 ? yMin : yMax;
+        double farY = y >= (yMin + yMax) / 2 ? yMin : yMax;
+        double viaX = (x - nearX) * (x - nearX) + (y - farY) * (y - farY);
+        double viaY = (y - nearY) * (y - nearY) + (x - farX) * (x - farX);
+        return std::min(viaX, viaY);
+    }
 };
 
 
@@ -59,11 +106,380 @@ struct Node {
     }
 };
 
+// Как insert выбирает узел и делит переполненный
+enum InsertPolicy {
+    // Guttman: минимум прироста площади, квадратичное деление
+    quadraticPolicy,
+    // R*-дерево: у листьев минимум прироста перекрытия, деление по оси с наименьшим
+    // периметром и повторная вставка части элементов при первом переполнении уровня
+    rStarPolicy
+};
+
+// Порядок листьев при bulkLoad
+enum BulkLoadOrder {
+    // Sort-Tile-Recursive: полосы по x, внутри полосы - по y
+    sortTileRecursive,
+    // по номеру центра на кривой Гильберта
+    hilbertOrder
+};
+
+// fn(0) ... fn(count - 1) на threads потоках
+template <typename Fn>
+void parallelFor(size_t count, unsigned threads, const Fn& fn) {
+    threads = std::min<size_t>(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (size_t i = next++; i < count; i = next++) fn(i);
+        });
+    }
+    for (auto& worker : workers) worker.join();
+}
+
+// Куски сортируются параллельно, потом сливаются попарно (тоже параллельно)
+template <typename T, typename Less>
+void parallelSort(std::vector<T>& items, unsigned threads, Less less) {
+    if (threads <= 1 || items.size() < 100000) {
+        std::sort(items.begin(), items.end(), less);
+        return;
+    }
+    std::vector<size_t> bounds(threads + 1);
+    for (unsigned c = 0; c <= threads; ++c) bounds[c] = items.size() * c / threads;
+    parallelFor(threads, threads, [&](size_t c) {
+        std::sort(items.begin() + bounds[c], items.begin() + bounds[c + 1], less);
+    });
+    for (size_t width = 1; width < threads; width *= 2) {
+        parallelFor((threads + 2 * width - 1) / (2 * width), threads, [&](size_t pair) {
+            size_t first = pair * 2 * width;
+            size_t middle = std::min<size_t>(first + width, threads);
+            size_t last = std::min<size_t>(first + 2 * width, threads);
+            std::inplace_merge(items.begin() + bounds[first], items.begin() + bounds[middle],
+                               items.begin() + bounds[last], less);
+        });
+    }
+}
+
+// Номер точки (x, y) на кривой Гильберта порядка 16 (сетка 65536×65536)
+uint32_t hilbertIndex(uint32_t x, uint32_t y) {
+    uint32_t index = 0;
+    for (uint32_t s = 1u << 15; s > 0; s >>= 1) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        index += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return index;
+}
+
+// Элемент уровня при bulkLoad: прямоугольник и его узел (на уровне листьев - пустой
+// узел или номер прямоугольника)
+template <typename Child>
+struct BulkItem {
+    Rectangle box;
+    Child child;
+};
+
+// Элементы [begin, end) делятся на groups почти равных групп (по умолчанию
+// ceil(count / maxEntries)): так последняя группа не оказывается меньше minEntries.
+// Возвращает начала групп.
+std::vector<size_t> packGroups(size_t begin, size_t end, size_t maxEntries, size_t groups = 0) {
+    size_t count = end - begin;
+    if (groups == 0) groups = (count + maxEntries - 1) / maxEntries;
+    std::vector<size_t> bounds;
+    for (size_t g = 0; g < groups; ++g) bounds.push_back(begin + count * g / groups);
+    return bounds;
+}
+
+// Упорядочивает элементы уровня и возвращает начала будущих узлов по maxEntries элементов
+template <typename Child>
+std::vector<size_t> orderLevel(std::vector<BulkItem<Child>>& items, BulkLoadOrder order, size_t maxEntries,
+                               unsigned threads) {
+    typedef BulkItem<Child> Item;
+    auto centerX = [](const Item& a, const Item& b) {
+        return a.box.xMin + a.box.xMax < b.box.xMin + b.box.xMax;
+    };
+    auto centerY = [](const Item& a, const Item& b) {
+        return a.box.yMin + a.box.yMax < b.box.yMin + b.box.yMax;
+    };
+
+    if (order == hilbertOrder) {
+        Rectangle bounds = items[0].box;
+        for (const auto& item : items) bounds.expandToInclude(item.box);
+        float width = std::max(bounds.xMax - bounds.xMin, std::numeric_limits<float>::min());
+        float height = std::max(bounds.yMax - bounds.yMin, std::numeric_limits<float>::min());
+        std::vector<std::pair<uint32_t, Item>> keyed(items.size(), {0, items[0]});
+        parallelFor(threads, threads, [&](size_t t) {
+            for (size_t i = items.size() * t / threads; i < items.size() * (t + 1) / threads; ++i) {
+                const Rectangle& box = items[i].box;
+                float x = std::min(1.0f, ((box.xMin + box.xMax) / 2 - bounds.xMin) / width);
+                float y = std::min(1.0f, ((box.yMin + box.yMax) / 2 - bounds.yMin) / height);
+                keyed[i] = {hilbertIndex(static_cast<uint32_t>(x * 65535), static_cast<uint32_t>(y * 65535)),
+                            items[i]};
+            }
+        });
+        parallelSort(keyed, threads, [](const std::pair<uint32_t, Item>& a, const std::pair<uint32_t, Item>& b) {
+            return a.first < b.first;
+        });
+        for (size_t i = 0; i < items.size(); ++i) items[i] = keyed[i].second;
+        return packGroups(0, items.size(), maxEntries);
+    }
+
+    // STR: sqrt(P) вертикальных полос по sqrt(P) узлов, P - число узлов уровня.
+    // В каждой полосе целое число узлов, а элементы поровну на все P узлов.
+    parallelSort(items, threads, centerX);
+    size_t nodes = (items.size() + maxEntries - 1) / maxEntries;
+    size_t slices = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(nodes))));
+    std::vector<std::vector<size_t>> sliceGroups(slices);
+    parallelFor(slices, threads, [&](size_t s) {
+        size_t firstNode = nodes * s / slices;
+        size_t lastNode = nodes * (s + 1) / slices;
+        size_t begin = items.size() * firstNode / nodes;
+        size_t end = items.size() * lastNode / nodes;
+        std::sort(items.begin() + begin, items.begin() + end, centerY);
+        sliceGroups[s] = packGroups(begin, end, maxEntries, lastNode - firstNode);
+    });
+    std::vector<size_t> starts;
+    for (const auto& groups : sliceGroups) starts.insert(starts.end(), groups.begin(), groups.end());
+    return starts;
+}
+
+class FlatRTree;
+
 class RTree {
 private:
+    friend class FlatRTree;
+
     Node* root;
     int maxEntries;
     int minEntries;
+    InsertPolicy policy;
+    size_t visitedNodes;
+
+    // элемент очереди nearest: узел или прямоугольник листа
+    struct NearestCandidate {
+        double distance2;
+        const Node* node; // узел или лист с прямоугольником
+        int entry;        // -1 - весь узел, иначе номер прямоугольника в листе
+
+        // при равном расстоянии прямоугольник раньше узла
+        bool operator>(const NearestCandidate& other) const {
+            if (distance2 != other.distance2) return distance2 > other.distance2;
+            return entry < other.entry;
+        }
+    };
+
+    // буферы nearest, чтобы не выделять память на каждый запрос
+    std::vector<NearestCandidate> nearestQueue;
+    std::vector<double> nearestFound;
+    std::vector<double> nearestGuaranteed;
+
+
+    // число уровней над листьями (все листья на одной глубине)
+    int height() const {
+        int levels = 0;
+        for (Node* node = root; !node->isLeaf; node = node->children[0]) ++levels;
+        return levels;
+    }
+
+    // R* ChooseSubtree: спуск от node (уровень nodeLevel, листья - 0) до узла уровня level.
+    // Если дети - листья, берется элемент с наименьшим приростом перекрытия с соседями,
+    // выше - с наименьшим приростом площади; ничьи - по приросту площади, затем по площади.
+    Node* chooseSubtree(Node* node, const Rectangle& rect, int nodeLevel, int level, std::vector<Node*>& path) {
+        path.push_back(node);
+        if (nodeLevel == level) return node;
+
+        size_t best = 0;
+        float bestOverlap = std::numeric_limits<float>::max();
+        float bestEnlargement = std::numeric_limits<float>::max();
+        float bestArea = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < node->entries.size(); ++i) {
+            Rectangle enlarged = node->entries[i];
+            enlarged.expandToInclude(rect);
+            float area = node->entries[i].area();
+            float enlargement = enlarged.area() - area;
+            float overlap = 0;
+            if (nodeLevel == 1) {
+                for (size_t j = 0; j < node->entries.size(); ++j) {
+                    if (j == i) continue;
+                    overlap += enlarged.overlapArea(node->entries[j]) - node->entries[i].overlapArea(node->entries[j]);
+                }
+            }
+            if (overlap < bestOverlap || (overlap == bestOverlap && enlargement < bestEnlargement) ||
+                (overlap == bestOverlap && enlargement == bestEnlargement && area < bestArea)) {
+                best = i;
+                bestOverlap = overlap;
+                bestEnlargement = enlargement;
+                bestArea = area;
+            }
+        }
+        return chooseSubtree(node->children[best], rect, nodeLevel - 1, level, path);
+    }
+
+    // R* split: для каждой оси элементы сортируются по нижней и по верхней границе и
+    // перебираются все деления на m..M+1-m элементов; ось - с наименьшей суммой
+    // периметров, на ней деление - с наименьшим перекрытием, затем площадью
+    void splitRStar(Node* node, Node*& newNode) {
+        const size_t count = node->entries.size();
+        const size_t minFill = std::max(1, minEntries);
+        std::vector<size_t> bestOrder(count);
+        for (size_t i = 0; i < count; ++i) bestOrder[i] = i;
+        size_t bestSplit = count / 2;
+        float bestMargin = std::numeric_limits<float>::max();
+
+        for (int axis = 0; axis < 2; ++axis) {
+            float marginSum = 0;
+            float axisOverlap = std::numeric_limits<float>::max();
+            float axisArea = std::numeric_limits<float>::max();
+            std::vector<size_t> axisOrder;
+            size_t axisSplit = 0;
+            for (int bound = 0; bound < 2; ++bound) {
+                auto key = [&](size_t i) {
+                    const Rectangle& r = node->entries[i];
+                    if (axis == 0) return bound == 0 ? std::make_pair(r.xMin, r.xMax) : std::make_pair(r.xMax, r.xMin);
+                    return bound == 0 ? std::make_pair(r.yMin, r.yMax) : std::make_pair(r.yMax, r.yMin);
+                };
+                std::vector<size_t> order(count);
+                for (size_t i = 0; i < count; ++i) order[i] = i;
+                std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return key(a) < key(b); });
+
+                // MBR первых k и последних count - k элементов
+                std::vector<Rectangle> prefix(count, node->entries[order[0]]);
+                std::vector<Rectangle> suffix(count, node->entries[order[count - 1]]);
+                for (size_t k = 1; k < count; ++k) {
+                    prefix[k] = prefix[k - 1];
+                    prefix[k].expandToInclude(node->entries[order[k]]);
+                    suffix[count - 1 - k] = suffix[count - k];
+                    suffix[count - 1 - k].expandToInclude(node->entries[order[count - 1 - k]]);
+                }
+                for (size_t k = minFill; k + minFill <= count; ++k) {
+                    const Rectangle& first = prefix[k - 1];
+                    const Rectangle& second = suffix[k];
+                    marginSum += first.margin() + second.margin();
+                    float overlap = first.overlapArea(second);
+                    float area = first.area() + second.area();
+                    if (overlap < axisOverlap || (overlap == axisOverlap && area < axisArea)) {
+                        axisOverlap = overlap;
+                        axisArea = area;
+                        axisOrder = order;
+                        axisSplit = k;
+                    }
+                }
+            }
+            if (axisSplit != 0 && marginSum < bestMargin) {
+                bestMargin = marginSum;
+                bestOrder = axisOrder;
+                bestSplit = axisSplit;
+            }
+        }
+
+        newNode = new Node(node->isLeaf);
+        std::vector<Rectangle> entries;
+        std::vector<Node*> children;
+        for (size_t k = 0; k < count; ++k) {
+            size_t i = bestOrder[k];
+            Node* target = k < bestSplit ? nullptr : newNode;
+            if (target) {
+                target->entries.push_back(node->entries[i]);
+                if (!node->isLeaf) target->children.push_back(node->children[i]);
+            } else {
+                entries.push_back(node->entries[i]);
+                if (!node->isLeaf) children.push_back(node->children[i]);
+            }
+        }
+        node->entries.swap(entries);
+        node->children.swap(children);
+    }
+
+    // элемент родителя, указывающий на node, приводится к MBR node
+    void updateParentEntry(Node* parent, Node* node) {
+        for (size_t j = 0; j < parent->children.size(); ++j) {
+            if (parent->children[j] == node) {
+                parent->entries[j] = node->getMBR();
+                break;
+            }
+        }
+    }
+
+    // R*: вставка прямоугольника rect (с поддеревом child высоты level, у листьев child
+    // пустой) в узел уровня level. При первом за эту вставку переполнении уровня (кроме
+    // корня) 30% элементов, чьи центры дальше всего от центра узла, вынимаются и
+    // вставляются заново, ближние первыми; при повторном узел делится.
+    void insertAtLevel(const Rectangle& rect, Node* child, int level, std::vector<bool>& overflowed) {
+        std::vector<Node*> path;
+        const int rootLevel = height();
+        Node* node = chooseSubtree(root, rect, rootLevel, level, path);
+        node->entries.push_back(rect);
+        if (child) node->children.push_back(child);
+
+        for (int i = static_cast<int>(path.size()) - 1; i >= 0; --i) {
+            node = path[i];
+            const int nodeLevel = rootLevel - i;
+            if (node->entries.size() <= static_cast<size_t>(maxEntries)) {
+                if (i > 0) updateParentEntry(path[i - 1], node);
+                continue;
+            }
+
+            if (i > 0 && !overflowed[nodeLevel]) {
+                overflowed[nodeLevel] = true;
+                Rectangle mbr = node->getMBR();
+                float cx = (mbr.xMin + mbr.xMax) / 2;
+                float cy = (mbr.yMin + mbr.yMax) / 2;
+                std::vector<std::pair<float, size_t>> distances;
+                for (size_t j = 0; j < node->entries.size(); ++j) {
+                    const Rectangle& r = node->entries[j];
+                    float dx = (r.xMin + r.xMax) / 2 - cx;
+                    float dy = (r.yMin + r.yMax) / 2 - cy;
+                    distances.push_back({dx * dx + dy * dy, j});
+                }
+                std::sort(distances.begin(), distances.end());
+                size_t keep = node->entries.size() - std::max<size_t>(1, maxEntries * 3 / 10);
+
+                std::vector<Rectangle> entries;
+                std::vector<Node*> children;
+                std::vector<std::pair<Rectangle, Node*>> removed;
+                for (size_t k = 0; k < distances.size(); ++k) {
+                    size_t j = distances[k].second;
+                    Node* subtree = node->isLeaf ? nullptr : node->children[j];
+                    if (k < keep) {
+                        entries.push_back(node->entries[j]);
+                        if (subtree) children.push_back(subtree);
+                    } else {
+                        removed.push_back({node->entries[j], subtree});
+                    }
+                }
+                node->entries.swap(entries);
+                node->children.swap(children);
+                for (int j = i; j > 0; --j) updateParentEntry(path[j - 1], path[j]);
+
+                for (const auto& entry : removed) insertAtLevel(entry.first, entry.second, nodeLevel, overflowed);
+                return;
+            }
+
+            Node* newNode = nullptr;
+            splitRStar(node, newNode);
+            if (i == 0) {
+                Node* newRoot = new Node(false);
+                newRoot->entries = {node->getMBR(), newNode->getMBR()};
+                newRoot->children = {node, newNode};
+                root = newRoot;
+            } else {
+                updateParentEntry(path[i - 1], node);
+                path[i - 1]->entries.push_back(newNode->getMBR());
+                path[i - 1]->children.push_back(newNode);
+            }
+        }
+    }
     
     Node* chooseLeaf(Node* node, const Rectangle& rect, std::vector<Node*>& path) {
         path.push_back(node);
@@ -121,7 +537,8 @@ private:
         std::vector<int> group1Entries = {seed1};
         std::vector<int> group2Entries = {seed2};
 
-        while (std::count(assigned.begin(), assigned.end(), false) > 0) {
+        size_t assignedCount = 2;
+        while (assignedCount < assigned.size()) {
             float maxDiff = -1;
             int nextEntry = -1;
             bool assignToGroup1;
@@ -146,7 +563,8 @@ private:
             }
 
             assigned[nextEntry] = true;
-            if (assignToGroup1 || (group1Entries.size() + assigned.size() - std::count(assigned.begin(), assigned.end(), false) < minEntries)) {
+            ++assignedCount;
+            if (assignToGroup1 || (group1Entries.size() + assignedCount < static_cast<size_t>(minEntries))) {
                 group1.expandToInclude(node->entries[nextEntry]);
                 group1Entries.push_back(nextEntry);
             } else {
@@ -170,58 +588,53 @@ private:
         
         *node = *new1;
         *newNode = *new2;
+        // дети уже переданы node и newNode, удалять их вместе с new1 и new2 нельзя
+        new1->children.clear();
+        new2->children.clear();
         delete new1;
+        delete new2;
     }
     
+    // Guttman CondenseTree по пути от корня до листа, из которого удаляли: снизу вверх
+    // недозаполненный узел (кроме корня) убирается из родителя, а его прямоугольники
+    // вставляются заново; у остальных обновляется MBR в родителе. Так MBR остаются
+    // точными, на что опираются nearest и FlatRTree. Корень с одним ребенком
+    // заменяется ребенком.
     void condenseTree(std::vector<Node*>& path) {
-        for (int i = path.size() - 1; i >= 0; --i) {
+        std::vector<Rectangle> orphans;
+        for (int i = static_cast<int>(path.size()) - 1; i > 0; --i) {
             Node* node = path[i];
-            if (node->entries.size() < minEntries) {
-                if (i == 0) { 
-                    if (!node->isLeaf && node->children.size() == 1) {
-                        Node* newRoot = node->children[0];
-                        node->children.clear();
-                        delete root;
-                        root = newRoot;
-                    }
+            Node* parent = path[i - 1];
+            if (node->entries.size() >= static_cast<size_t>(minEntries)) {
+                updateParentEntry(parent, node);
+                continue;
+            }
+            collectEntries(node, orphans);
+            for (int j = 0; j < static_cast<int>(parent->children.size()); ++j) {
+                if (parent->children[j] == node) {
+                    parent->removeEntry(j);
                     break;
-                } else {
-                    Node* parent = path[i - 1];
-                    int index = -1;
-                    for (int j = 0; j < parent->children.size(); ++j) {
-                        if (parent->children[j] == node) {
-                            index = j;
-                            break;
-                        }
-                    }
-                    
-                    for (auto& entry : node->entries) {
-                        parent->children[index]->entries.push_back(entry);
-                    }
-                    for (auto& child : node->children) {
-                        parent->children[index]->children.push_back(child);
-                    }
-                    node->entries.clear();
-                    node->children.clear();
-
-                    parent->removeEntry(index);
-                }
-            } else {
-                if (i > 0) {
-                    Node* parent = path[i - 1];
-                    for (int j = 0; j < parent->children.size(); ++j) {
-                        if (parent->children[j] == node) {
-                            parent->entries[j] = node->getMBR();
-                            break;
-                        }
-                    }
                 }
             }
         }
+        while (!root->isLeaf && root->children.size() <= 1) {
+            Node* newRoot = root->children.empty() ? new Node(true) : root->children[0];
+            root->children.clear();
+            delete root;
+            root = newRoot;
+        }
+        for (const auto& rect : orphans) insert(rect);
+    }
+
+    // все прямоугольники листьев поддерева node
+    static void collectEntries(const Node* node, std::vector<Rectangle>& rects) {
+        if (node->isLeaf) rects.insert(rects.end(), node->entries.begin(), node->entries.end());
+        else for (auto child : node->children) collectEntries(child, rects);
     }
 
 public:
-    RTree(int maxE = 4, int minE = 2) : maxEntries(maxE), minEntries(minE) {
+    RTree(int maxE = 4, int minE = 2, InsertPolicy policy = quadraticPolicy)
+        : maxEntries(maxE), minEntries(minE), policy(policy), visitedNodes(0) {
         root = new Node(true);
     }
 
@@ -230,6 +643,11 @@ public:
     }
 
     void insert(const Rectangle& rect) {
+        if (policy == rStarPolicy) {
+            std::vector<bool> overflowed(64, false);
+            insertAtLevel(rect, nullptr, 0, overflowed);
+            return;
+        }
         std::vector<Node*> path;
         Node* leaf = chooseLeaf(root, rect, path);
 
@@ -291,7 +709,7 @@ public:
     bool removeHelper(Node* node, const Rectangle& rect, std::vector<Node*>& path) {
         path.push_back(node);
         if (node->isLeaf) {
-            for (int i = 0; i < node->entries.size(); ++i) {
+            for (size_t i = 0; i < node->entries.size(); ++i) {
                 if (std::abs(node->entries[i].xMin - rect.xMin) < 0.1 &&
                     std::abs(node->entries[i].xMax - rect.xMax) < 0.1 &&
                     std::abs(node->entries[i].yMin - rect.yMin) < 0.1 &&
@@ -300,32 +718,196 @@ public:
                     return true;
                 }
             }
-            return false;
+        } else {
+            for (size_t i = 0; i < node->entries.size(); ++i) {
+                if (node->entries[i].intersects(rect) && removeHelper(node->children[i], rect, path)) return true;
+            }
         }
+        // в этом поддереве нет - путь идет не через node
+        path.pop_back();
+        return false;
+    }
 
-        for (int i = 0; i < node->entries.size(); ++i) {
-            if (node->entries[i].intersects(rect)) {
-                if (removeHelper(node->children[i], rect, path)) {
-                    if (node->children[i]->entries.size() < minEntries) {
-                        path.pop_back();
-                        condenseTree(path);
-                    } else {
-                        node->entries[i] = node->children[i]->getMBR();
-                    }
-                    return true;
+    // Строит дерево заново снизу вверх из всех rects: элементы упорядочиваются (STR или
+    // по кривой Гильберта) и режутся на полностью заполненные узлы, затем так же
+    // строится каждый следующий уровень. Сортировка и создание узлов идут на threads
+    // потоках (0 - по числу ядер).
+    void bulkLoad(std::vector<Rectangle> rects, BulkLoadOrder order = sortTileRecursive, unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        delete root;
+        root = new Node(true);
+        if (rects.empty()) return;
+
+        std::vector<BulkItem<Node*>> items;
+        items.reserve(rects.size());
+        for (const auto& rect : rects) items.push_back({rect, nullptr});
+        rects.clear();
+        rects.shrink_to_fit();
+
+        bool leafLevel = true;
+        while (items.size() > static_cast<size_t>(maxEntries)) {
+            std::vector<size_t> starts = orderLevel(items, order, maxEntries, threads);
+            std::vector<BulkItem<Node*>> parents(starts.size(), items[0]);
+            parallelFor(starts.size(), threads, [&](size_t g) {
+                size_t end = g + 1 < starts.size() ? starts[g + 1] : items.size();
+                Node* node = new Node(leafLevel);
+                node->entries.reserve(end - starts[g]);
+                if (!leafLevel) node->children.reserve(end - starts[g]);
+                for (size_t i = starts[g]; i < end; ++i) {
+                    node->entries.push_back(items[i].box);
+                    if (!leafLevel) node->children.push_back(items[i].child);
                 }
-            }
+                parents[g] = {node->getMBR(), node};
+            });
+            items.swap(parents);
+            leafLevel = false;
+        }
+
+        root->isLeaf = leafLevel;
+        for (const auto& item : items) {
+            root->entries.push_back(item.box);
+            if (!leafLevel) root->children.push_back(item.child);
         }
-        return false;
     }
 
     std::vector<Rectangle> search(const Rectangle& area) {
         std::vector<Rectangle> results;
+        visitedNodes = 0;
         searchHelper(root, area, results);
         return results;
     }
 
+    // Ближайшие к точке (x, y) прямоугольники по возрастанию расстояния, best-first: в
+    // очереди узлы и прямоугольники по MINDIST, узел раскрывается, когда он ближе всего
+    // остального. visit(rect, distance) получает их по одному и возвращает false, чтобы
+    // остановиться - дальше очередь не разбирается. k - сколько нужно самое большее:
+    // в очередь не попадает то, что дальше k-го гарантированного расстояния (MINMAXDIST
+    // детей узла, расстояния уже найденных прямоугольников). Возвращает число выданных.
+    template <typename Visit>
+    size_t nearest(float x, float y, size_t k, Visit visit) {
+        // очередь - min-куча в nearestQueue; found - k наименьших расстояний
+        // прямоугольников, попавших в очередь (max-куча)
+        std::vector<NearestCandidate>& queue = nearestQueue;
+        std::vector<double>& found = nearestFound;
+        std::vector<double>& guaranteed = nearestGuaranteed;
+        auto push = [&](const NearestCandidate& candidate) {
+            queue.push_back(candidate);
+            std::push_heap(queue.begin(), queue.end(), std::greater<NearestCandidate>());
+        };
+        queue.clear();
+        found.clear();
+        const bool limited = k < std::numeric_limits<size_t>::max();
+        double bound = std::numeric_limits<double>::infinity();
+
+        visitedNodes = 0;
+        size_t reported = 0;
+        if (k > 0) push({0, root, -1});
+        while (!queue.empty() && reported < k) {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<NearestCandidate>());
+            NearestCandidate top = queue.back();
+            queue.pop_back();
+            if (top.distance2 > bound) break;
+            if (top.entry >= 0) {
+                ++reported;
+                if (!visit(top.node->entries[top.entry], std::sqrt(top.distance2))) break;
+                continue;
+            }
+
+            const Node* node = top.node;
+            ++visitedNodes;
+            if (node->isLeaf) {
+                for (int i = 0; i < static_cast<int>(node->entries.size()); ++i) {
+                    double distance2 = node->entries[i].minDistance2(x, y);
+                    if (distance2 > bound) continue;
+                    push({distance2, node, i});
+                    if (!limited) continue;
+                    found.push_back(distance2);
+                    std::push_heap(found.begin(), found.end());
+                    if (found.size() > k) {
+                        std::pop_heap(found.begin(), found.end());
+                        found.pop_back();
+                    }
+                    if (found.size() == k) bound = std::min(bound, found.front());
+                }
+                continue;
+            }
+            // у разных детей разные объекты, так что k-я по величине MINMAXDIST детей тоже
+            // ограничивает расстояние до k-го ближайшего
+            if (node->entries.size() >= k) {
+                guaranteed.clear();
+                for (const auto& entry : node->entries) guaranteed.push_back(entry.minMaxDistance2(x, y));
+                std::nth_element(guaranteed.begin(), guaranteed.begin() + (k - 1), guaranteed.end());
+                bound = std::min(bound, guaranteed[k - 1]);
+            }
+            for (size_t i = 0; i < node->entries.size(); ++i) {
+                double distance2 = node->entries[i].minDistance2(x, y);
+                if (distance2 <= bound) push({distance2, node->children[i], -1});
+            }
+        }
+        return reported;
+    }
+
+    // Все прямоугольники не дальше radius от точки (x, y), в порядке обхода дерева;
+    // visit(rect, distance) возвращает false, чтобы остановиться. Если нужен порядок по
+    // расстоянию - nearest без k до первого дальше radius. Возвращает число выданных.
+    template <typename Visit>
+    size_t withinDistance(float x, float y, float radius, Visit visit) {
+        visitedNodes = 0;
+        // отрицательный радиус - пустой круг, а не круг радиуса |radius|
+        if (radius < 0) return 0;
+        const double radius2 = static_cast<double>(radius) * radius;
+        size_t reported = 0;
+        std::vector<const Node*> stack = {root};
+        while (!stack.empty()) {
+            const Node* node = stack.back();
+            stack.pop_back();
+            ++visitedNodes;
+            for (size_t i = 0; i < node->entries.size(); ++i) {
+                double distance2 = node->entries[i].minDistance2(x, y);
+                if (distance2 > radius2) continue;
+                if (!node->isLeaf) {
+                    stack.push_back(node->children[i]);
+                    continue;
+                }
+                ++reported;
+                if (!visit(node->entries[i], std::sqrt(distance2))) return reported;
+            }
+        }
+        return reported;
+    }
+
+    // сколько узлов прочитал последний search, nearest или withinDistance
+    size_t lastVisitedNodes() const {
+        return visitedNodes;
+    }
+
+    size_t nodeCount() const {
+        return countNodes(root);
+    }
+
+    size_t countNodes(const Node* node) const {
+        size_t count = 1;
+        for (auto child : node->children) count += countNodes(child);
+        return count;
+    }
+
+    // память под узлы: сами Node, буферы их векторов и около 16 служебных байт malloc
+    // на каждое выделение
+    size_t memoryBytes() const {
+        return memoryBytes(root);
+    }
+
+    size_t memoryBytes(const Node* node) const {
+        const size_t mallocOverhead = 16;
+        size_t bytes = sizeof(Node) + mallocOverhead;
+        if (node->entries.capacity()) bytes += node->entries.capacity() * sizeof(Rectangle) + mallocOverhead;
+        if (node->children.capacity()) bytes += node->children.capacity() * sizeof(Node*) + mallocOverhead;
+        for (auto child : node->children) bytes += memoryBytes(child);
+        return bytes;
+    }
+
     void searchHelper(Node* node, const Rectangle& area, std::vector<Rectangle>& results) {
+        ++visitedNodes;
         for (int i = 0; i < node->entries.size(); ++i) {
             if (node->entries[i].intersects(area)) {
                 if (node->isLeaf) {
@@ -338,7 +920,357 @@ public:
     }
 };
 
-int main() {
+// Емкость узла FlatRTree
+const int flatNodeCapacity = 16;
+
+// Узел плоского дерева. Прямоугольники детей лежат по координатам (SoA): каждый массив -
+// одна строка кэша, весь узел - пять строк. Дети - 32-битные индексы узлов в том же
+// массиве, у листа - номера прямоугольников. Координаты свободных мест - NaN: любое
+// сравнение с NaN ложно, и место не пересекается ни с каким окном, даже с бесконечным
+// (вывернутый прямоугольник +inf..-inf окно на всю плоскость нашло бы). Поэтому поиску
+// не нужен счетчик, а листу - признак: лист определяется по уровню при спуске.
+struct alignas(64) FlatNode {
+    float xMin[flatNodeCapacity];
+    float yMin[flatNodeCapacity];
+    float xMax[flatNodeCapacity];
+    float yMax[flatNodeCapacity];
+    uint32_t child[flatNodeCapacity];
+};
+
+static_assert(sizeof(FlatNode) == 5 * 64, "FlatNode should take exactly five cache lines");
+
+// Проверка всех мест узла на пересечение с area: бит k маски - место k. Свободные
+// места (NaN) не проходят ни при каком area: сравнения только упорядоченные.
+typedef uint32_t (*NodeScan)(const FlatNode& node, const Rectangle& area);
+
+// без ветвлений: компилятор может векторизовать и сам, но без гарантий
+uint32_t scanNodeScalar(const FlatNode& node, const Rectangle& area) {
+    uint32_t hits = 0;
+    for (int k = 0; k < flatNodeCapacity; ++k) {
+        bool hit = (node.xMin[k] <= area.xMax) & (node.xMax[k] >= area.xMin) & (node.yMin[k] <= area.yMax) &
+                   (node.yMax[k] >= area.yMin);
+        hits |= static_cast<uint32_t>(hit) << k;
+    }
+    return hits;
+}
+
+#ifdef RTREE_X86
+// 16 мест - две половины по 8: четыре сравнения, три and и movemask на половину
+__attribute__((target("avx2")))
+uint32_t scanNodeAvx2(const FlatNode& node, const Rectangle& area) {
+    const __m256 xMin = _mm256_set1_ps(area.xMin);
+    const __m256 yMin = _mm256_set1_ps(area.yMin);
+    const __m256 xMax = _mm256_set1_ps(area.xMax);
+    const __m256 yMax = _mm256_set1_ps(area.yMax);
+    uint32_t hits = 0;
+    for (int half = 0; half < flatNodeCapacity; half += 8) {
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(node.xMin + half), xMax, _CMP_LE_OQ),
+                                   _mm256_cmp_ps(_mm256_load_ps(node.xMax + half), xMin, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_load_ps(node.yMin + half), yMax, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_load_ps(node.yMax + half), yMin, _CMP_GE_OQ));
+        hits |= static_cast<uint32_t>(_mm256_movemask_ps(hit)) << half;
+    }
+    return hits;
+}
+#endif
+
+struct NodeScanVariant {
+    const char* name;
+    NodeScan scan;
+};
+
+std::vector<NodeScanVariant> availableNodeScans() {
+    std::vector<NodeScanVariant> scans = {{"scalar", scanNodeScalar}};
+#ifdef RTREE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) scans.push_back({"avx2", scanNodeAvx2});
+#endif
+    return scans;
+}
+
+// проверка узла в FlatRTree::search; по умолчанию самая быстрая из доступных
+NodeScan nodeScan = availableNodeScans().back().scan;
+
+// R-дерево только для запросов: узлы фиксированной емкости лежат подряд в одном
+// массиве (арене), без отдельных выделений памяти и указателей. Строится bulkLoad
+// сразу в этом виде или копированием RTree, построенного вставками.
+class FlatRTree {
+private:
+    std::vector<FlatNode> nodes;
+    uint32_t root;
+    uint32_t height; // уровень корня, у листьев 0
+    size_t visitedNodes;
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // узел и его уровень
+
+    uint32_t allocateNode() {
+        nodes.emplace_back();
+        FlatNode& node = nodes.back();
+        const float empty = std::numeric_limits<float>::quiet_NaN();
+        for (int k = 0; k < flatNodeCapacity; ++k) {
+            node.xMin[k] = node.yMin[k] = node.xMax[k] = node.yMax[k] = empty;
+            node.child[k] = 0;
+        }
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    static void setEntry(FlatNode& node, size_t k, const Rectangle& box, uint32_t child) {
+        node.xMin[k] = box.xMin;
+        node.yMin[k] = box.yMin;
+        node.xMax[k] = box.xMax;
+        node.yMax[k] = box.yMax;
+        node.child[k] = child;
+    }
+
+    static Rectangle entryBox(const FlatNode& node, int k) {
+        return Rectangle(node.xMin[k], node.yMin[k], node.xMax[k], node.yMax[k]);
+    }
+
+    // заполняет узел items[begin, end) и возвращает его элемент для уровня выше
+    BulkItem<uint32_t> fillNode(uint32_t index, const std::vector<BulkItem<uint32_t>>& items, size_t begin,
+                                size_t end) {
+        Rectangle box = items[begin].box;
+        for (size_t i = begin; i < end; ++i) {
+            setEntry(nodes[index], i - begin, items[i].box, items[i].child);
+            box.expandToInclude(items[i].box);
+        }
+        return {box, index};
+    }
+
+    // копия поддерева RTree в порядке обхода в глубину; листья нумеруют
+    // прямоугольники по порядку обхода
+    uint32_t copyNode(const Node* node, uint32_t& entryCount) {
+        uint32_t index = allocateNode();
+        for (size_t k = 0; k < node->entries.size(); ++k) {
+            uint32_t child = node->isLeaf ? entryCount++ : copyNode(node->children[k], entryCount);
+            setEntry(nodes[index], k, node->entries[k], child);
+        }
+        return index;
+    }
+
+public:
+    FlatRTree() : root(0), height(0), visitedNodes(0) {
+        allocateNode();
+    }
+
+    // Копия tree; дерево с maxEntries больше flatNodeCapacity строится заново bulkLoad
+    explicit FlatRTree(const RTree& tree) : root(0), height(0), visitedNodes(0) {
+        if (tree.maxEntries > flatNodeCapacity) {
+            std::vector<Rectangle> rects;
+            RTree::collectEntries(tree.root, rects);
+            bulkLoad(rects);
+            return;
+        }
+        nodes.reserve(tree.nodeCount());
+        uint32_t entryCount = 0;
+        height = tree.height();
+        root = copyNode(tree.root, entryCount);
+    }
+
+    // То же построение, что RTree::bulkLoad, но узлы сразу пишутся в арену, уровень за
+    // уровнем. Номер прямоугольника в листе - его индекс в rects.
+    void bulkLoad(std::vector<Rectangle> rects, BulkLoadOrder order = sortTileRecursive, unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        nodes.clear();
+        height = 0;
+        std::vector<BulkItem<uint32_t>> items;
+        items.reserve(rects.size());
+        for (size_t i = 0; i < rects.size(); ++i) items.push_back({rects[i], static_cast<uint32_t>(i)});
+        rects.clear();
+        rects.shrink_to_fit();
+
+        while (items.size() > static_cast<size_t>(flatNodeCapacity)) {
+            std::vector<size_t> starts = orderLevel(items, order, flatNodeCapacity, threads);
+            uint32_t first = static_cast<uint32_t>(nodes.size());
+            for (size_t g = 0; g < starts.size(); ++g) allocateNode();
+            std::vector<BulkItem<uint32_t>> parents(starts.size(), items[0]);
+            parallelFor(starts.size(), threads, [&](size_t g) {
+                size_t end = g + 1 < starts.size() ? starts[g + 1] : items.size();
+                parents[g] = fillNode(first + static_cast<uint32_t>(g), items, starts[g], end);
+            });
+            items.swap(parents);
+            ++height;
+        }
+
+        root = allocateNode();
+        if (!items.empty()) fillNode(root, items, 0, items.size());
+        // арена росла удвоением, отдаем лишнее
+        nodes.shrink_to_fit();
+    }
+
+    std::vector<Rectangle> search(const Rectangle& area) {
+        std::vector<Rectangle> results;
+        visitedNodes = 0;
+        stack.assign(1, {root, height});
+        while (!stack.empty()) {
+            const FlatNode& node = nodes[stack.back().first];
+            uint32_t level = stack.back().second;
+            stack.pop_back();
+            ++visitedNodes;
+            // обходим только попавшие места, по установленным битам маски
+            for (uint32_t hits = nodeScan(node, area); hits; hits &= hits - 1) {
+                int k = __builtin_ctz(hits);
+                if (level == 0) results.push_back(entryBox(node, k));
+                else stack.push_back({node.child[k], level - 1});
+            }
+        }
+        return results;
+    }
+
+    size_t lastVisitedNodes() const {
+        return visitedNodes;
+    }
+
+    size_t nodeCount() const {
+        return nodes.size();
+    }
+
+    // память под узлы: арена одним куском
+    size_t memoryBytes() const {
+        return nodes.capacity() * sizeof(FlatNode);
+    }
+};
+
+// Случайные прямоугольники со сторонами до maxSide в квадрате 10000×10000
+std::vector<Rectangle> randomRectangles(size_t count, std::mt19937& gen, float maxSide = 10) {
+    std::uniform_real_distribution<float> position(0, 10000);
+    std::uniform_real_distribution<float> side(0, maxSide);
+    std::vector<Rectangle> rects;
+    rects.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        float x = position(gen);
+        float y = position(gen);
+        rects.emplace_back(x, y, x + side(gen), y + side(gen));
+    }
+    return rects;
+}
+
+// Построение вставками (Guttman и R*) и bulkLoad (STR и Гильберт, один поток и все),
+// затем одинаковые запросы-окна 100×100 к каждому дереву: сколько узлов читает запрос.
+// maxSide = 10 - почти не перекрывающиеся прямоугольники, 200 - сильно перекрывающиеся.
+void benchmark(size_t count, float maxSide) {
+    const int maxEntries = 16;
+    const int minEntries = 6;
+    const size_t queries = 10000;
+    std::mt19937 gen(42);
+    std::vector<Rectangle> rects = randomRectangles(count, gen, maxSide);
+    std::vector<Rectangle> windows;
+    std::uniform_real_distribution<float> position(0, 9900);
+    for (size_t q = 0; q < queries; ++q) {
+        float x = position(gen);
+        float y = position(gen);
+        windows.emplace_back(x, y, x + 100, y + 100);
+    }
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+    printf("%zu rectangles up to %gx%g, M = %d, m = %d, %u threads\n", count, maxSide, maxSide, maxEntries,
+           minEntries, threads);
+    printf("%-20s %10s %10s %12s %12s %12s %12s\n", "build", "seconds", "nodes", "bytes/entry", "visits/query",
+           "found/query", "ns/query");
+    auto report = [&](const char* name, double build, auto& tree) {
+        size_t visits = 0;
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& window : windows) {
+            found += tree.search(window).size();
+            visits += tree.lastVisitedNodes();
+        }
+        std::chrono::duration<double> search = std::chrono::steady_clock::now() - start;
+        printf("%-20s %10.3f %10zu %12.1f %12.1f %12.1f %12.0f\n", name, build, tree.nodeCount(),
+               static_cast<double>(tree.memoryBytes()) / count, static_cast<double>(visits) / queries,
+               static_cast<double>(found) / queries, search.count() / queries * 1e9);
+        fflush(stdout);
+    };
+
+    for (int variant = 0; variant < 6; ++variant) {
+        const char* names[] = {"insert", "insert r*", "str x1", "str", "hilbert x1", "hilbert"};
+        RTree tree(maxEntries, minEntries, variant == 1 ? rStarPolicy : quadraticPolicy);
+        auto start = std::chrono::steady_clock::now();
+        if (variant <= 1) {
+            for (const auto& rect : rects) tree.insert(rect);
+        } else {
+            tree.bulkLoad(rects, variant <= 3 ? sortTileRecursive : hilbertOrder, variant % 2 ? threads : 1);
+        }
+        std::chrono::duration<double> build = std::chrono::steady_clock::now() - start;
+        report(names[variant], build.count(), tree);
+
+        // плоская копия дерева из вставок и плоский bulkLoad
+        if (variant == 1 || variant == 3 || variant == 5) {
+            start = std::chrono::steady_clock::now();
+            FlatRTree flat;
+            if (variant == 1) flat = FlatRTree(tree);
+            else flat.bulkLoad(rects, variant == 3 ? sortTileRecursive : hilbertOrder, threads);
+            build = std::chrono::steady_clock::now() - start;
+            // проверка узлов: скалярная и векторные
+            const char* flatNames[] = {"r* flat", "str flat", "hilbert flat"};
+            NodeScan defaultScan = nodeScan;
+            const float inf = std::numeric_limits<float>::infinity();
+            for (const auto& scan : availableNodeScans()) {
+                nodeScan = scan.scan;
+                std::string name = std::string(flatNames[variant / 2]) + " " + scan.name;
+                // окно на всю плоскость находит каждый прямоугольник один раз, свободные места - нет
+                size_t all = flat.search(Rectangle(-inf, -inf, inf, inf)).size();
+                if (all != count) printf("%s: full-plane window found %zu of %zu\n", name.c_str(), all, count);
+                report(name.c_str(), build.count(), flat);
+            }
+            nodeScan = defaultScan;
+        }
+    }
+
+    // ближайшие соседи и круг на дереве из bulkLoad; "boxes 10" - прежний способ: окно
+    // растет вдвое, пока во вписанный в него круг не попадут 10 прямоугольников
+    RTree tree(maxEntries, minEntries);
+    tree.bulkLoad(rects, sortTileRecursive, threads);
+    printf("\n%-20s %12s %12s %12s\n", "query", "visits/query", "found/query", "ns/query");
+    for (int variant = 0; variant < 5; ++variant) {
+        const char* names[] = {"nearest 1", "nearest 10", "nearest 100", "boxes 10", "within 50"};
+        const size_t k[] = {1, 10, 100};
+        auto accept = [](const Rectangle&, double) { return true; };
+        size_t visits = 0;
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& window : windows) {
+            float x = (window.xMin + window.xMax) / 2;
+            float y = (window.yMin + window.yMax) / 2;
+            if (variant < 3) {
+                found += tree.nearest(x, y, k[variant], accept);
+            } else if (variant == 4) {
+                found += tree.withinDistance(x, y, 50, accept);
+            } else {
+                for (float r = 10;; r *= 2) {
+                    std::vector<Rectangle> hits = tree.search(Rectangle(x - r, y - r, x + r, y + r));
+                    visits += tree.lastVisitedNodes();
+                    std::vector<double> distances;
+                    for (const auto& hit : hits) {
+                        double distance2 = hit.minDistance2(x, y);
+                        if (distance2 <= static_cast<double>(r) * r) distances.push_back(distance2);
+                    }
+                    if (distances.size() >= 10 || hits.size() == rects.size()) {
+                        size_t taken = std::min<size_t>(10, distances.size());
+                        std::partial_sort(distances.begin(), distances.begin() + taken, distances.end());
+                        found += taken;
+                        break;
+                    }
+                }
+                continue;
+            }
+            visits += tree.lastVisitedNodes();
+        }
+        std::chrono::duration<double> search = std::chrono::steady_clock::now() - start;
+        printf("%-20s %12.1f %12.1f %12.0f\n", names[variant], static_cast<double>(visits) / queries,
+               static_cast<double>(found) / queries, search.count() / queries * 1e9);
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv) {
+    // task6 --bench[=N] - сравнение построения вставками и bulkLoad на N прямоугольниках
+    if (argc > 1 && strncmp(argv[1], "--bench", 7) == 0) {
+        size_t count = argv[1][7] == '=' ? strtoull(argv[1] + 8, nullptr, 10) : 1000000;
+        benchmark(count, 10);
+        printf("\n");
+        benchmark(count, 200);
+        return 0;
+    }
 
    // Пример использования
     